@@ -0,0 +1,1173 @@
+#include <string.h>
+
+#include "runtime/error.h"
+#include "runtime/validate.h"
+#include "runtime/hashmap.h"
+#include "special.h"
+#include "eval.h"
+#include "system.h"
+
+#include "compile.h"
+
+/* Maximum nesting of macro expansions made while compiling. */
+#define MAX_COMPILE_EXPANSIONS 64
+
+Code *create_code(CodeType type, NseVal form) {
+  Code *code = allocate(sizeof(Code));
+  if (!code) {
+    return NULL;
+  }
+  memset(code, 0, sizeof(Code));
+  code->type = type;
+  if (form.type && form.type->internal == INTERNAL_SYNTAX) {
+    code->form = add_ref(form).syntax;
+  }
+  return code;
+}
+
+Code **create_code_array(size_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+  Code **array = allocate(sizeof(Code *) * size);
+  if (array) {
+    memset(array, 0, sizeof(Code *) * size);
+  }
+  return array;
+}
+
+static void delete_code_array(Code **array, size_t size) {
+  if (array) {
+    for (size_t i = 0; i < size; i++) {
+      delete_code(array[i]);
+    }
+    free(array);
+  }
+}
+
+static void delete_pattern_array(Pattern **array, size_t size) {
+  if (array) {
+    for (size_t i = 0; i < size; i++) {
+      delete_pattern(array[i]);
+    }
+    free(array);
+  }
+}
+
+static void delete_symbol(Symbol *symbol) {
+  if (symbol) {
+    del_ref(SYMBOL(symbol));
+  }
+}
+
+static void delete_symbol_array(Symbol **array, size_t size) {
+  if (array) {
+    for (size_t i = 0; i < size; i++) {
+      delete_symbol(array[i]);
+    }
+    free(array);
+  }
+}
+
+void delete_code(Code *code) {
+  if (!code) {
+    return;
+  }
+  switch (code->type) {
+    case CODE_CONST:
+      del_ref(code->constant);
+      break;
+    case CODE_LOCAL:
+    case CODE_ENV:
+    case CODE_GLOBAL:
+    case CODE_BINDING:
+      delete_symbol(code->var.symbol);
+      if (code->var.binding) {
+        delete_binding(code->var.binding);
+      }
+      break;
+    case CODE_TYPE_QUOTE:
+      delete_code(code->type_quote.body);
+      break;
+    case CODE_TRY:
+      delete_code(code->body);
+      break;
+    case CODE_IF:
+      delete_code(code->if_.condition);
+      delete_code(code->if_.consequent);
+      delete_code(code->if_.alternative);
+      break;
+    case CODE_DO:
+      delete_code_array(code->block.statements, code->block.size);
+      free(code->block.slots);
+      free(code->block.bind);
+      break;
+    case CODE_LET:
+      delete_pattern_array(code->let.patterns, code->let.size);
+      free(code->let.slots);
+      free(code->let.boxes);
+      delete_code_array(code->let.values, code->let.size);
+      delete_code(code->let.body);
+      break;
+    case CODE_MATCH:
+      delete_code(code->match.value);
+      delete_pattern_array(code->match.patterns, code->match.size);
+      delete_code_array(code->match.bodies, code->match.size);
+      if (HASH_MAP_INITIALIZED(code->match.branches)) {
+        BranchMapIterator it = create_branch_map_iterator(code->match.branches);
+        for (BranchMapEntry entry = branch_map_next(it); entry.key; entry = branch_map_next(it)) {
+          free(entry.value->cases);
+          free(entry.value);
+        }
+        delete_branch_map_iterator(it);
+        delete_branch_map(code->match.branches);
+      }
+      free(code->match.other_tags.cases);
+      break;
+    case CODE_FN:
+    case CODE_DEF_FUNC:
+    case CODE_DEF_MACRO:
+      delete_symbol(code->fn.name);
+      del_ref(code->fn.lambda);
+      if (code->fn.type) {
+        delete_type(code->fn.type);
+      }
+      if (code->fn.doc) {
+        del_ref(STRING(code->fn.doc));
+      }
+      break;
+    case CODE_CALL:
+    case CODE_MACRO:
+    case CODE_CONTINUE:
+    case CODE_TAIL_CONS:
+      delete_code(code->call.function);
+      delete_code_array(code->call.args, code->call.size);
+      delete_code(code->call.rest);
+      delete_symbol(code->call.name);
+      del_ref(code->call.macro_args);
+      delete_lex_scope(code->call.scope);
+      if (code->call.expansion) {
+        delete_code(code->call.expansion->code);
+        free(code->call.expansion);
+      }
+      break;
+    case CODE_RECUR:
+      delete_parameters(&code->recur.parameters);
+      free(code->recur.init_slots);
+      delete_code_array(code->recur.inits, code->recur.init_size);
+      delete_code(code->recur.body);
+      break;
+    case CODE_LOOP:
+      if (code->loop.ins) {
+        for (size_t i = 0; i < code->loop.size; i++) {
+          delete_pattern(code->loop.ins[i].pattern);
+          delete_code(code->loop.ins[i].code);
+        }
+        free(code->loop.ins);
+      }
+      break;
+    case CODE_DEF_VAR:
+    case CODE_DEF_READ_MACRO:
+      delete_symbol(code->def.name);
+      delete_code(code->def.value);
+      break;
+    case CODE_SPECIAL:
+      del_ref(code->special.args);
+      delete_symbol_array(code->special.names, code->special.size);
+      delete_code_array(code->special.vars, code->special.size);
+      delete_lex_scope(code->special.scope);
+      break;
+  }
+  if (code->form) {
+    del_ref(SYNTAX(code->form));
+  }
+  free(code);
+}
+
+void delete_pattern(Pattern *pattern) {
+  if (!pattern) {
+    return;
+  }
+  switch (pattern->type) {
+    case PATTERN_LITERAL:
+    case PATTERN_QUOTE:
+      del_ref(pattern->literal.value);
+      break;
+    case PATTERN_CONS:
+      delete_pattern(pattern->cons.head);
+      delete_pattern(pattern->cons.tail);
+      break;
+    default:
+      break;
+  }
+  if (pattern->form) {
+    del_ref(SYNTAX(pattern->form));
+  }
+  free(pattern);
+}
+
+void delete_parameters(Parameters *parameters) {
+  if (parameters->params) {
+    for (size_t i = 0; i < parameters->size; i++) {
+      delete_pattern(parameters->params[i].pattern);
+      delete_symbol(parameters->params[i].keyword);
+      delete_code(parameters->params[i].default_value);
+    }
+    free(parameters->params);
+  }
+  free(parameters->key_table);
+  parameters->params = NULL;
+  parameters->key_table = NULL;
+  parameters->size = 0;
+}
+
+static void delete_lambda(Lambda *lambda) {
+  delete_parameters(&lambda->parameters);
+  delete_code(lambda->body);
+  free(lambda->captures);
+  free(lambda);
+}
+
+LexScope *copy_lex_scope(LexScope *scope) {
+  if (scope) {
+    scope->refs++;
+  }
+  return scope;
+}
+
+void delete_lex_scope(LexScope *scope) {
+  while (scope && --scope->refs == 0) {
+    LexScope *next = scope->next;
+    delete_symbol(scope->symbol);
+    if (scope->runtime) {
+      delete_scope(scope->runtime);
+    }
+    free(scope->captures);
+    free(scope);
+    scope = next;
+  }
+}
+
+static LexScope *create_lex_scope(LexScopeType type, Symbol *symbol, size_t size, LexScope *next) {
+  LexScope *scope = allocate(sizeof(LexScope));
+  if (!scope) {
+    return NULL;
+  }
+  scope->refs = 1;
+  scope->type = type;
+  scope->symbol = symbol ? add_ref(SYMBOL(symbol)).symbol : NULL;
+  scope->size = size;
+  scope->uses = 0;
+  scope->captures_size = 0;
+  scope->captures = NULL;
+  scope->sealed = 0;
+  scope->runtime = NULL;
+  scope->namespace = VALUE_SCOPE;
+  scope->next = copy_lex_scope(next);
+  return scope;
+}
+
+int init_compiler(Compiler *c, Scope *scope) {
+  LexScope *root = create_lex_scope(LEX_ROOT, NULL, 0, NULL);
+  if (!root) {
+    return 0;
+  }
+  root->runtime = copy_scope(scope);
+  Scope *module_scope = scope;
+  while (module_scope->symbol && module_scope->next) {
+    module_scope = module_scope->next;
+  }
+  root->namespace = module_scope->type;
+  c->scope = root;
+  c->frame_size = 0;
+  c->module = scope->module;
+  c->expansions = 0;
+  return 1;
+}
+
+void init_nested_compiler(Compiler *c, LexScope *scope, Module *module) {
+  c->scope = copy_lex_scope(scope);
+  c->frame_size = scope->size;
+  c->module = module;
+  c->expansions = 0;
+}
+
+void delete_compiler(Compiler *c) {
+  delete_lex_scope(c->scope);
+  c->scope = NULL;
+}
+
+LexScope *compile_push(Compiler *c, LexScopeType type, Symbol *symbol) {
+  size_t size = type == LEX_FUNCTION ? 0 : c->scope->size + 1;
+  LexScope *scope = create_lex_scope(type, symbol, size, c->scope);
+  if (!scope) {
+    return NULL;
+  }
+  delete_lex_scope(c->scope);
+  c->scope = scope;
+  if (size > c->frame_size) {
+    c->frame_size = size;
+  }
+  return scope;
+}
+
+void compile_pop_until(Compiler *c, LexScope *scope) {
+  while (c->scope != scope) {
+    LexScope *next = copy_lex_scope(c->scope->next);
+    delete_lex_scope(c->scope);
+    c->scope = next;
+  }
+}
+
+/* Adds a variable of the enclosing function to the free variables of a
+ * function, and sets `index` to its index in the environment. Returns 0 if the
+ * function has already been compiled and the variable was not captured. */
+static int capture(LexScope *function, int env, size_t index, size_t *env_index) {
+  for (size_t i = 0; i < function->captures_size; i++) {
+    if (function->captures[i].env == env && function->captures[i].index == index) {
+      *env_index = i + 1;
+      return 1;
+    }
+  }
+  if (function->sealed) {
+    return 0;
+  }
+  Capture *captures = realloc(function->captures, sizeof(Capture) * (function->captures_size + 1));
+  if (!captures) {
+    raise_error(out_of_memory_error, "out of memory");
+    return 0;
+  }
+  captures[function->captures_size] = (Capture){ .env = env, .index = index };
+  function->captures = captures;
+  function->captures_size++;
+  *env_index = function->captures_size;
+  return 1;
+}
+
+/* Looks for a local variable in `scope` and the scopes of the enclosing
+ * functions, capturing it in every function in between. Returns 1 if found, 0
+ * if the variable is not a local variable, or -1 if it could not be captured.
+ * Sets `var` to the location of the variable, or `root` to the root scope if
+ * not found. */
+static int resolve_local(Symbol *symbol, LexScope *scope, Code *var, LexScope **root) {
+  for (; scope; scope = scope->next) {
+    switch (scope->type) {
+      case LEX_LOCAL:
+      case LEX_BOX:
+        if (scope->symbol != symbol) {
+          break;
+        }
+        var->type = CODE_LOCAL;
+        var->var.index = scope->size - 1;
+        if (scope->type == LEX_BOX) {
+          var->var.boxed = 1;
+          scope->uses++;
+        }
+        return 1;
+      case LEX_FUNCTION: {
+        int found = resolve_local(symbol, scope->next, var, root);
+        if (found <= 0) {
+          return found;
+        }
+        if (!capture(scope, var->type == CODE_ENV, var->var.index, &var->var.index)) {
+          return -1;
+        }
+        var->type = CODE_ENV;
+        return 1;
+      }
+      case LEX_ROOT:
+        *root = scope;
+        return 0;
+    }
+  }
+  *root = NULL;
+  return 0;
+}
+
+Code *compile_variable(Symbol *symbol, Compiler *c) {
+  Code *code = create_code(CODE_LOCAL, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->var.symbol = add_ref(SYMBOL(symbol)).symbol;
+  LexScope *root = NULL;
+  switch (resolve_local(symbol, c->scope, code, &root)) {
+    case 1:
+      return code;
+    case -1:
+      raise_error(name_error, "variable not captured by closure: %s", symbol->name);
+      delete_code(code);
+      return NULL;
+  }
+  if (!root) {
+    raise_error(name_error, "undefined name: %s", symbol->name);
+    delete_code(code);
+    return NULL;
+  }
+  for (Scope *runtime = root->runtime; runtime && runtime->symbol; runtime = runtime->next) {
+    if (runtime->symbol == symbol) {
+      code->type = CODE_BINDING;
+      code->var.binding = copy_binding(runtime->binding);
+      return code;
+    }
+  }
+  code->type = CODE_GLOBAL;
+  code->var.global = module_binding(symbol, root->namespace);
+  return code;
+}
+
+/* Marks every local variable in scope as referenced. This is needed for calls
+ * that are only expanded when they are executed: since macros are unhygienic
+ * the expansion may refer to any local variable, so all of them must be
+ * captured by the enclosing closures before those closures are sealed. */
+static void mark_variables(Compiler *c) {
+  for (LexScope *scope = c->scope; scope; scope = scope->next) {
+    if (scope->type == LEX_LOCAL || scope->type == LEX_BOX) {
+      Code var = { .type = CODE_LOCAL };
+      LexScope *root;
+      resolve_local(scope->symbol, c->scope, &var, &root);
+    }
+  }
+}
+
+static Pattern *create_pattern(PatternType type) {
+  Pattern *pattern = allocate(sizeof(Pattern));
+  if (pattern) {
+    memset(pattern, 0, sizeof(Pattern));
+    pattern->type = type;
+  }
+  return pattern;
+}
+
+Pattern *compile_pattern(NseVal form, Compiler *c) {
+  Pattern *pattern = NULL;
+  switch (form.type->internal) {
+    case INTERNAL_SYNTAX:
+      pattern = compile_pattern(form.syntax->quoted, c);
+      if (pattern && !pattern->form) {
+        pattern->form = add_ref(form).syntax;
+      }
+      return pattern;
+    case INTERNAL_SYMBOL: {
+      LexScope *scope = compile_push(c, LEX_LOCAL, form.symbol);
+      if (!scope) {
+        return NULL;
+      }
+      pattern = create_pattern(PATTERN_BIND);
+      if (pattern) {
+        pattern->slot = scope->size - 1;
+      }
+      return pattern;
+    }
+    case INTERNAL_QUOTE:
+      pattern = create_pattern(PATTERN_QUOTE);
+      if (pattern) {
+        pattern->literal.value = add_ref(form.quote->quoted);
+        pattern->literal.tag = to_symbol(form.quote->quoted);
+      }
+      return pattern;
+    case INTERNAL_CONS:
+      pattern = create_pattern(PATTERN_CONS);
+      if (!pattern) {
+        return NULL;
+      }
+      pattern->cons.head = compile_pattern(form.cons->head, c);
+      pattern->cons.tail = THENP(pattern->cons.head, compile_pattern(form.cons->tail, c));
+      if (!pattern->cons.tail) {
+        delete_pattern(pattern);
+        return NULL;
+      }
+      return pattern;
+    case INTERNAL_NIL:
+      return create_pattern(PATTERN_NIL);
+    case INTERNAL_I64:
+    case INTERNAL_F64:
+      pattern = create_pattern(PATTERN_LITERAL);
+      if (pattern) {
+        pattern->literal.value = add_ref(form);
+      }
+      return pattern;
+    default:
+      return create_pattern(PATTERN_INVALID);
+  }
+}
+
+/* Reads a symbol or a `(SYMBOL DEFAULT)` pair from an &opt or &key
+ * parameter list. */
+static Symbol *optional_parameter(NseVal param, NseVal *default_value) {
+  Symbol *symbol;
+  *default_value = undefined;
+  if (is_cons(param)) {
+    symbol = to_symbol(head(param));
+    *default_value = elem(1, param);
+    if (!RESULT_OK(*default_value)) {
+      set_debug_form(tail(param));
+      raise_error(domain_error, "expected a default value");
+      return NULL;
+    }
+  } else {
+    symbol = to_symbol(param);
+  }
+  if (!symbol) {
+    set_debug_form(param);
+    raise_error(domain_error, "expected a symbol");
+  }
+  return symbol;
+}
+
+static int compile_rest_parameter(NseVal formal, Param *param, Compiler *c) {
+  Cons *cons = to_cons(formal);
+  Symbol *name = cons && is_nil(cons->tail) ? to_symbol(cons->head) : NULL;
+  if (!name) {
+    set_debug_form(formal);
+    raise_error(domain_error, "&rest must be followed by exactly one symbol");
+    return 0;
+  }
+  LexScope *scope = compile_push(c, LEX_LOCAL, name);
+  if (!scope) {
+    return 0;
+  }
+  param->type = PARAM_REST;
+  param->slot = scope->size - 1;
+  return 1;
+}
+
+/* Builds the keyword table of the named parameters, which are last in the
+ * parameter list. Returns 0 if allocation fails. */
+static int compile_key_table(Parameters *parameters) {
+  size_t start = parameters->size;
+  while (start > 0 && parameters->params[start - 1].type == PARAM_KEY) {
+    start--;
+  }
+  if (start == parameters->size) {
+    return 1;
+  }
+  size_t table_size = 2;
+  while (table_size < (parameters->size - start) * 2) {
+    table_size *= 2;
+  }
+  size_t *table = allocate(sizeof(size_t) * table_size);
+  if (!table) {
+    return 0;
+  }
+  memset(table, 0, sizeof(size_t) * table_size);
+  size_t mask = table_size - 1;
+  for (size_t i = start; i < parameters->size; i++) {
+    size_t j = pointer_hash(parameters->params[i].keyword) & mask;
+    while (table[j]) {
+      j = (j + 1) & mask;
+    }
+    table[j] = i + 1;
+  }
+  parameters->key_table = table;
+  parameters->key_mask = mask;
+  return 1;
+}
+
+/* Compiles named parameters. All named parameters are visible to the default
+ * values, which are evaluated in order. */
+static int compile_key_parameters(NseVal formal, Param *params, size_t *size, Compiler *c) {
+  size_t start = *size;
+  NseVal default_value;
+  for (NseVal param = formal; is_cons(param); param = tail(param)) {
+    Symbol *symbol = optional_parameter(head(param), &default_value);
+    if (!symbol) {
+      return 0;
+    }
+    LexScope *scope = compile_push(c, LEX_LOCAL, symbol);
+    if (!scope) {
+      return 0;
+    }
+    params[*size].type = PARAM_KEY;
+    params[*size].slot = scope->size - 1;
+    params[*size].keyword = intern_keyword(symbol->name);
+    (*size)++;
+  }
+  for (size_t i = start; i < *size; i++) {
+    optional_parameter(head(formal), &default_value);
+    if (RESULT_OK(default_value)) {
+      params[i].default_value = compile(default_value, c);
+      if (!params[i].default_value) {
+        return 0;
+      }
+    }
+    formal = tail(formal);
+  }
+  return 1;
+}
+
+static int compile_opt_parameters(NseVal formal, Param *params, size_t *size, Compiler *c) {
+  while (is_cons(formal)) {
+    NseVal default_value;
+    Symbol *symbol = optional_parameter(head(formal), &default_value);
+    if (!symbol) {
+      return 0;
+    }
+    if (symbol == key_keyword) {
+      return compile_key_parameters(tail(formal), params, size, c);
+    } else if (symbol == rest_keyword) {
+      if (!compile_rest_parameter(tail(formal), &params[*size], c)) {
+        return 0;
+      }
+      (*size)++;
+      return 1;
+    }
+    Param *param = &params[*size];
+    param->type = PARAM_OPTIONAL;
+    if (RESULT_OK(default_value)) {
+      param->default_value = compile(default_value, c);
+      if (!param->default_value) {
+        return 0;
+      }
+    }
+    (*size)++;
+    LexScope *scope = compile_push(c, LEX_LOCAL, symbol);
+    if (!scope) {
+      return 0;
+    }
+    param->slot = scope->size - 1;
+    formal = tail(formal);
+  }
+  return 1;
+}
+
+static int compile_parameter_list(NseVal formal, Param *params, size_t *size, Compiler *c) {
+  while (is_cons(formal)) {
+    NseVal h = head(formal);
+    Symbol *param = to_symbol(h);
+    if (!param) {
+      set_debug_form(h);
+      raise_error(syntax_error, "expected a symbol");
+      return 0;
+    }
+    if (param == key_keyword) {
+      return compile_key_parameters(tail(formal), params, size, c);
+    } else if (param == opt_keyword) {
+      return compile_opt_parameters(tail(formal), params, size, c);
+    } else if (param == rest_keyword) {
+      if (!compile_rest_parameter(tail(formal), &params[*size], c)) {
+        return 0;
+      }
+      (*size)++;
+      return 1;
+    }
+    NseVal pattern = SYMBOL(param);
+    if (param == match_keyword) {
+      formal = tail(formal);
+      Cons *cons = to_cons(formal);
+      if (!cons) {
+        set_debug_form(formal);
+        raise_error(syntax_error, "&match must be followed by a pattern");
+        return 0;
+      }
+      pattern = cons->head;
+    }
+    params[*size].type = PARAM_REQUIRED;
+    params[*size].pattern = compile_pattern(pattern, c);
+    if (!params[*size].pattern) {
+      return 0;
+    }
+    (*size)++;
+    formal = tail(formal);
+  }
+  if (!is_nil(formal)) {
+    set_debug_form(formal);
+    raise_error(syntax_error, "formal parameters must be a proper list");
+    return 0;
+  }
+  return 1;
+}
+
+static size_t syntax_length(NseVal list) {
+  size_t length = 0;
+  while (is_cons(list)) {
+    length++;
+    list = tail(list);
+  }
+  return length;
+}
+
+int compile_parameters(NseVal formal, Parameters *parameters, Compiler *c) {
+  size_t max_size = syntax_length(formal);
+  parameters->params = NULL;
+  parameters->size = 0;
+  parameters->key_table = NULL;
+  parameters->key_mask = 0;
+  if (max_size == 0) {
+    return compile_parameter_list(formal, NULL, &parameters->size, c);
+  }
+  parameters->params = allocate(sizeof(Param) * max_size);
+  if (!parameters->params) {
+    return 0;
+  }
+  memset(parameters->params, 0, sizeof(Param) * max_size);
+  if (!compile_parameter_list(formal, parameters->params, &parameters->size, c)) {
+    // Include a partially compiled parameter
+    if (parameters->size < max_size) {
+      parameters->size++;
+    }
+    delete_parameters(parameters);
+    return 0;
+  }
+  if (!compile_key_table(parameters)) {
+    delete_parameters(parameters);
+    return 0;
+  }
+  return 1;
+}
+
+static int is_self_call(Code *code, Symbol *name) {
+  return code->type == CODE_CALL && code->call.name == name
+    && code->call.function->type != CODE_LOCAL;
+}
+
+/* Whether `code` is `(cons EXPR (SELF {EXPR}))`. The self-call is left as is,
+ * so the node can still be executed as an ordinary call if `cons` is
+ * redefined. */
+static int is_tail_cons(Code *code, Symbol *name) {
+  if (code->call.size != 2 || code->call.rest || code->call.function->type != CODE_GLOBAL
+      || !code->call.function->var.global) {
+    return 0;
+  }
+  NseVal function = *code->call.function->var.global;
+  if (!RESULT_OK(function) || function.type->internal != INTERNAL_FUNC || function.func != cons_) {
+    return 0;
+  }
+  return is_self_call(code->call.args[1], name);
+}
+
+static int optimize_tail_call_code(Code *code, Symbol *name, size_t *continues) {
+  switch (code->type) {
+    case CODE_CALL:
+      if (is_self_call(code, name)) {
+        delete_code(code->call.function);
+        code->call.function = NULL;
+        code->type = CODE_CONTINUE;
+        (*continues)++;
+        return 1;
+      }
+      if (is_tail_cons(code, name)) {
+        code->type = CODE_TAIL_CONS;
+        return 1;
+      }
+      return 0;
+    case CODE_IF: {
+      int consequent = optimize_tail_call_code(code->if_.consequent, name, continues);
+      int alternative = optimize_tail_call_code(code->if_.alternative, name, continues);
+      return consequent || alternative;
+    }
+    case CODE_DO:
+      if (code->block.size > 0 && !code->block.bind[code->block.size - 1]) {
+        return optimize_tail_call_code(code->block.statements[code->block.size - 1], name, continues);
+      }
+      return 0;
+    case CODE_LET:
+      return optimize_tail_call_code(code->let.body, name, continues);
+    case CODE_MATCH: {
+      int optimized = 0;
+      for (size_t i = 0; i < code->match.size; i++) {
+        if (optimize_tail_call_code(code->match.bodies[i], name, continues)) {
+          optimized = 1;
+        }
+      }
+      return optimized;
+    }
+    case CODE_MACRO:
+      // An expansion made at compile time. If the macro is redefined, the new
+      // expansion is executed without the rewrite.
+      if (code->call.expansion) {
+        return optimize_tail_call_code(code->call.expansion->code, name, continues);
+      }
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+size_t optimize_tail_call(Lambda *lambda, Symbol *name) {
+  size_t continues = 0;
+  if (optimize_tail_call_code(lambda->body, name, &continues)) {
+    lambda->loop = 1;
+  }
+  return continues;
+}
+
+int compile_arguments(Code *code, NseVal args, Compiler *c) {
+  code->call.size = syntax_length(args);
+  if (code->call.size > 0) {
+    code->call.args = create_code_array(code->call.size);
+    if (!code->call.args) {
+      return 0;
+    }
+  }
+  for (size_t i = 0; i < code->call.size; i++) {
+    code->call.args[i] = compile(head(args), c);
+    if (!code->call.args[i]) {
+      return 0;
+    }
+    args = tail(args);
+  }
+  if (!is_nil(args)) {
+    NseVal rest = strip_syntax(args);
+    if (!is_symbol(rest) && rest.type->internal != INTERNAL_QUOTE) {
+      set_debug_form(args);
+      raise_error(syntax_error, "the tail of a dotted call must be a list");
+      return 0;
+    }
+    code->call.rest = compile(args, c);
+    if (!code->call.rest) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Returns 1 if a call may turn out to be a call to a macro that is defined
+ * after the call is compiled, i.e. if the operator is a global variable that has
+ * not been defined yet. */
+static int may_be_macro(Code *function) {
+  return function && function->type == CODE_GLOBAL
+    && (!function->var.global || !RESULT_OK(*function->var.global));
+}
+
+/* Expands a call to a macro that is defined when the call is compiled and
+ * compiles the expansion in the scope of the call, so the enclosing closures
+ * capture only the variables that the expansion refers to. The expansion is
+ * cached in the call like an expansion made when the call is executed, and is
+ * replaced if the macro is redefined. Returns 0 if the expansion is left until
+ * the call is executed, e.g. if the macro fails. */
+static int compile_expansion(Code *code, NseVal macro_function, Compiler *c) {
+  if (c->expansions >= MAX_COMPILE_EXPANSIONS) {
+    // A macro may expand to a call to itself in a branch that is never taken
+    return 0;
+  }
+  NseVal expanded = nse_apply(macro_function, code->call.macro_args);
+  Code *compiled = NULL;
+  if (RESULT_OK(expanded)) {
+    c->expansions++;
+    compiled = compile(expanded, c);
+    c->expansions--;
+    del_ref(expanded);
+  }
+  Expansion *expansion = THENP(compiled, allocate(sizeof(Expansion)));
+  if (!expansion) {
+    delete_code(compiled);
+    clear_error();
+    clear_stack_trace();
+    return 0;
+  }
+  expansion->code = compiled;
+  expansion->frame_size = 0;
+  expansion->version = code->call.name->macro;
+  expansion->active = 0;
+  code->call.expansion = expansion;
+  code->type = CODE_MACRO;
+  return 1;
+}
+
+Code *compile_call(NseVal operator, NseVal args, int strict, Compiler *c) {
+  Code *code = create_code(CODE_CALL, undefined);
+  if (!code) {
+    return NULL;
+  }
+  Symbol *name = to_symbol(operator);
+  if (name) {
+    code->call.name = add_ref(SYMBOL(name)).symbol;
+    code->call.scope = copy_lex_scope(c->scope);
+  }
+  code->call.macro_args = add_ref(args);
+  if (name && !strict) {
+    NseVal macro_function = find_macro(name);
+    if (RESULT_OK(macro_function)) {
+      if (compile_expansion(code, macro_function, c)) {
+        return code;
+      }
+      mark_variables(c);
+    }
+  }
+  code->call.function = compile(operator, c);
+  if (name && may_be_macro(code->call.function)) {
+    mark_variables(c);
+  }
+  if (!code->call.function || !compile_arguments(code, args, c)) {
+    if (name && !strict) {
+      delete_code(code->call.function);
+      delete_code_array(code->call.args, code->call.size);
+      delete_code(code->call.rest);
+      code->call.function = NULL;
+      code->call.args = NULL;
+      code->call.size = 0;
+      code->call.rest = NULL;
+      code->type = CODE_MACRO;
+      mark_variables(c);
+      return code;
+    }
+    delete_code(code);
+    return NULL;
+  }
+  return code;
+}
+
+Code *compile_block(NseVal block, Compiler *c) {
+  size_t size = syntax_length(block);
+  Symbol *name = NULL;
+  NseVal expr = undefined;
+  if (size == 1 && !VALIDATE(head(block), V_EXACT(let_symbol), V_SYMBOL(&name), V_ANY(&expr))) {
+    return compile(head(block), c);
+  }
+  Code *code = create_code(CODE_DO, undefined);
+  if (!code) {
+    return NULL;
+  }
+  if (size == 0) {
+    return code;
+  }
+  code->block.statements = create_code_array(size);
+  code->block.slots = allocate(sizeof(size_t) * size);
+  code->block.bind = allocate(sizeof(int) * size);
+  if (!code->block.statements || !code->block.slots || !code->block.bind) {
+    delete_code(code);
+    return NULL;
+  }
+  memset(code->block.bind, 0, sizeof(int) * size);
+  code->block.size = size;
+  LexScope *start = c->scope;
+  for (size_t i = 0; i < size; i++) {
+    NseVal statement = head(block);
+    if (VALIDATE(statement, V_EXACT(let_symbol), V_SYMBOL(&name), V_ANY(&expr))) {
+      code->block.statements[i] = compile(expr, c);
+      LexScope *scope = THENP(code->block.statements[i], compile_push(c, LEX_LOCAL, name));
+      if (!scope) {
+        compile_pop_until(c, start);
+        delete_code(code);
+        return NULL;
+      }
+      code->block.slots[i] = scope->size - 1;
+      code->block.bind[i] = 1;
+    } else {
+      code->block.statements[i] = compile(statement, c);
+    }
+    if (!code->block.statements[i]) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
+    }
+    block = tail(block);
+  }
+  compile_pop_until(c, start);
+  return code;
+}
+
+NseVal compile_lambda(NseVal formal, NseVal body, Compiler *c) {
+  Lambda *lambda = allocate(sizeof(Lambda));
+  if (!lambda) {
+    return undefined;
+  }
+  memset(lambda, 0, sizeof(Lambda));
+  Compiler fc;
+  fc.module = c->module;
+  fc.frame_size = 0;
+  fc.expansions = c->expansions;
+  fc.scope = copy_lex_scope(c->scope);
+  LexScope *function = compile_push(&fc, LEX_FUNCTION, NULL);
+  if (!function
+      || !compile_parameters(formal, &lambda->parameters, &fc)
+      || !(lambda->body = compile_block(body, &fc))) {
+    delete_compiler(&fc);
+    delete_lambda(lambda);
+    return undefined;
+  }
+  function->sealed = 1;
+  if (function->captures_size > 0) {
+    lambda->captures = allocate(sizeof(Capture) * function->captures_size);
+    if (!lambda->captures) {
+      delete_compiler(&fc);
+      delete_lambda(lambda);
+      return undefined;
+    }
+    memcpy(lambda->captures, function->captures, sizeof(Capture) * function->captures_size);
+  }
+  lambda->frame_size = fc.frame_size;
+  lambda->env_size = 1 + function->captures_size;
+  lambda->module = fc.module;
+  delete_compiler(&fc);
+  Reference *ref = create_reference(copy_type(code_type), lambda, (Destructor) delete_lambda);
+  if (!ref) {
+    delete_lambda(lambda);
+    return undefined;
+  }
+  return REFERENCE(ref);
+}
+
+static Code *compile_special(NseVal (*f)(NseVal, Scope *), NseVal args, Compiler *c) {
+  Code *code = create_code(CODE_SPECIAL, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->special.f = f;
+  code->special.args = add_ref(args);
+  code->special.scope = copy_lex_scope(c->scope);
+  size_t size = 0;
+  for (LexScope *scope = c->scope; scope; scope = scope->next) {
+    if (scope->type == LEX_LOCAL || scope->type == LEX_BOX) {
+      size++;
+    }
+  }
+  if (size == 0) {
+    return code;
+  }
+  code->special.names = allocate(sizeof(Symbol *) * size);
+  code->special.vars = create_code_array(size);
+  if (!code->special.names || !code->special.vars) {
+    delete_code(code);
+    return NULL;
+  }
+  for (LexScope *scope = c->scope; scope; scope = scope->next) {
+    if (scope->type != LEX_LOCAL && scope->type != LEX_BOX) {
+      continue;
+    }
+    int shadowed = 0;
+    for (size_t i = 0; i < code->special.size; i++) {
+      if (code->special.names[i] == scope->symbol) {
+        shadowed = 1;
+        break;
+      }
+    }
+    if (shadowed) {
+      continue;
+    }
+    Code *var = compile_variable(scope->symbol, c);
+    if (!var) {
+      delete_code(code);
+      return NULL;
+    }
+    code->special.names[code->special.size] = add_ref(SYMBOL(scope->symbol)).symbol;
+    code->special.vars[code->special.size] = var;
+    code->special.size++;
+  }
+  return code;
+}
+
+static Code *compile_cons(Cons *cons, Compiler *c) {
+  NseVal operator = cons->head;
+  NseVal args = cons->tail;
+  Symbol *macro_name = to_symbol(operator);
+  if (macro_name) {
+    switch (macro_name->special) {
+      case SPECIAL_NONE:
+        break;
+      case SPECIAL_IF:
+        return compile_if(args, c);
+      case SPECIAL_LET:
+        return compile_let(args, c);
+      case SPECIAL_MATCH:
+        return compile_match(args, c);
+      case SPECIAL_DO:
+        return compile_block(args, c);
+      case SPECIAL_FN:
+        return compile_fn(args, c);
+      case SPECIAL_TRY:
+        return compile_try(args, c);
+      case SPECIAL_CONTINUE:
+        return compile_continue(args, c);
+      case SPECIAL_RECUR:
+        return compile_recur(args, c);
+      case SPECIAL_DEF:
+        return compile_def(args, c);
+      case SPECIAL_DEF_READ_MACRO:
+        return compile_def_read_macro(args, c);
+      case SPECIAL_DEF_TYPE:
+        return compile_special(eval_def_type, args, c);
+      case SPECIAL_DEF_DATA:
+        return compile_special(eval_def_data, args, c);
+      case SPECIAL_DEF_MACRO:
+        return compile_def_macro(args, c);
+      case SPECIAL_DEF_GENERIC:
+        return compile_special(eval_def_generic, args, c);
+      case SPECIAL_DEF_METHOD:
+        return compile_special(eval_def_method, args, c);
+      case SPECIAL_LOOP:
+        return compile_loop(args, c);
+    }
+  }
+  return compile_call(operator, args, 0, c);
+}
+
+static Code *compile_type_quote(NseVal quoted, Compiler *c) {
+  Scope *type_scope = use_module_types(c->module);
+  Compiler tc;
+  int ok = init_compiler(&tc, type_scope);
+  delete_scope(type_scope);
+  if (!ok) {
+    return NULL;
+  }
+  Code *body = compile(quoted, &tc);
+  size_t frame_size = tc.frame_size;
+  delete_compiler(&tc);
+  if (!body) {
+    return NULL;
+  }
+  Code *code = create_code(CODE_TYPE_QUOTE, undefined);
+  if (!code) {
+    delete_code(body);
+    return NULL;
+  }
+  code->type_quote.body = body;
+  code->type_quote.frame_size = frame_size;
+  return code;
+}
+
+Code *compile(NseVal form, Compiler *c) {
+  Code *code = NULL;
+  switch (form.type->internal) {
+    case INTERNAL_CONS:
+      return compile_cons(form.cons, c);
+    case INTERNAL_I64:
+    case INTERNAL_F64:
+    case INTERNAL_STRING:
+      code = create_code(CODE_CONST, undefined);
+      if (code) {
+        code->constant = add_ref(form);
+      }
+      return code;
+    case INTERNAL_QUOTE:
+      if (form.type == type_quote_type) {
+        return compile_type_quote(form.quote->quoted, c);
+      } else {
+        NseVal datum = syntax_to_datum(form.quote->quoted);
+        if (!RESULT_OK(datum)) {
+          return NULL;
+        }
+        code = create_code(CODE_CONST, undefined);
+        if (!code) {
+          del_ref(datum);
+          return NULL;
+        }
+        code->constant = datum;
+        return code;
+      }
+    case INTERNAL_SYMBOL:
+      if (form.type == keyword_type) {
+        code = create_code(CODE_CONST, undefined);
+        if (code) {
+          code->constant = add_ref(form);
+        }
+        return code;
+      }
+      return compile_variable(form.symbol, c);
+    case INTERNAL_SYNTAX: {
+      Syntax *previous = push_debug_form(form.syntax);
+      code = compile(form.syntax->quoted, c);
+      if (code && !code->form) {
+        code->form = add_ref(form).syntax;
+      }
+      pop_debug_form(code ? nil : undefined, previous);
+      return code;
+    }
+    default:
+      raise_error(domain_error, "unexpected value type: %s", ""); // TODO
+      return NULL;
+  }
+}
+
+DEFINE_HASH_MAP(branch_map, BranchMap, Symbol *, MatchBranch *, pointer_hash, pointer_equals)
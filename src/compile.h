@@ -0,0 +1,458 @@
+#ifndef NSE_COMPILE_H
+#define NSE_COMPILE_H
+
+/* Compilation of syntax into code trees.
+ *
+ * Instead of re-interpreting the Syntax/Cons structure of a form every time it
+ * is evaluated, forms are compiled once into a tree of `Code` nodes which is
+ * then executed by `exec()` in eval.c. Special forms are recognized, and their
+ * operands destructured, at compile time.
+ *
+ * Variables are resolved during compilation. Local variables are assigned to
+ * slots in the frame of the function that binds them. The variables of
+ * enclosing functions that are referenced by a function are its free
+ * variables, which are copied into the environment of a closure when it is
+ * created. Global variables are resolved to the definition boxes of their
+ * modules.
+ *
+ * A `Code` tree owns all values it references (constants, symbols, patterns,
+ * source forms) and is deleted with `delete_code()`.
+ */
+
+#include "runtime/value.h"
+#include "runtime/hashmap.h"
+#include "module.h"
+
+typedef struct Code Code;
+typedef struct Expansion Expansion;
+typedef struct Lambda Lambda;
+typedef struct LoopIns LoopIns;
+typedef struct Pattern Pattern;
+typedef struct MatchBranch MatchBranch;
+typedef struct Param Param;
+typedef struct Parameters Parameters;
+typedef struct Capture Capture;
+typedef struct LexScope LexScope;
+typedef struct Compiler Compiler;
+
+DECLARE_HASH_MAP(branch_map, BranchMap, Symbol *, MatchBranch *)
+
+/* Types of code nodes. */
+typedef enum {
+  /* A self-evaluating value, e.g. a number, a string, a keyword or a quoted
+   * datum. */
+  CODE_CONST,
+  /* A variable in a slot of the current frame. */
+  CODE_LOCAL,
+  /* A variable captured in the environment of the current closure. */
+  CODE_ENV,
+  /* A module-level definition. */
+  CODE_GLOBAL,
+  /* A variable bound in the scope that the code was compiled in. */
+  CODE_BINDING,
+  /* A type quote, body is evaluated in the type namespace. */
+  CODE_TYPE_QUOTE,
+  /* (if EXPR EXPR EXPR) */
+  CODE_IF,
+  /* (do {STMT}) and bodies of functions, let and match. */
+  CODE_DO,
+  /* (let ({(PATTERN EXPR)}) {STMT}) */
+  CODE_LET,
+  /* (match EXPR {(PATTERN {STMT})}) */
+  CODE_MATCH,
+  /* (fn FORMAL {STMT}) */
+  CODE_FN,
+  /* (try EXPR) */
+  CODE_TRY,
+  /* Function application. */
+  CODE_CALL,
+  /* Application of a macro, expanded at runtime. */
+  CODE_MACRO,
+  /* (continue {EXPR}) */
+  CODE_CONTINUE,
+  /* (cons EXPR (SELF {EXPR})) in tail position of the function SELF, see
+   * `optimize_tail_call()`. */
+  CODE_TAIL_CONS,
+  /* (recur FORMAL EXPR) */
+  CODE_RECUR,
+  /* (loop {LOOP_INS}) */
+  CODE_LOOP,
+  /* (def SYMBOL EXPR) */
+  CODE_DEF_VAR,
+  /* (def (SYMBOL {FORMAL}) {STMT}) */
+  CODE_DEF_FUNC,
+  /* (def-macro (SYMBOL {FORMAL}) {STMT}) */
+  CODE_DEF_MACRO,
+  /* (def-read-macro SYMBOL EXPR) */
+  CODE_DEF_READ_MACRO,
+  /* Special forms that are evaluated directly from syntax, e.g. def-data. */
+  CODE_SPECIAL,
+} CodeType;
+
+/* Types of loop instructions. */
+typedef enum {
+  LOOP_FOR,
+  LOOP_LET,
+  LOOP_IF,
+  LOOP_COLLECT,
+  LOOP_DO,
+} LoopInsType;
+
+/* Types of patterns. */
+typedef enum {
+  /* Binds the value to a slot. */
+  PATTERN_BIND,
+  /* A number. */
+  PATTERN_LITERAL,
+  /* A quoted datum, also matches constructors without parameters. */
+  PATTERN_QUOTE,
+  /* A list, or a constructor if the head is a quote. */
+  PATTERN_CONS,
+  /* The empty list. */
+  PATTERN_NIL,
+  /* Any other value, never matches. */
+  PATTERN_INVALID,
+} PatternType;
+
+/* Types of formal parameters. */
+typedef enum {
+  PARAM_REQUIRED,
+  PARAM_OPTIONAL,
+  PARAM_KEY,
+  PARAM_REST,
+} ParamType;
+
+/* Types of lexical scopes. */
+typedef enum {
+  /* The scope that top-level code is compiled in. */
+  LEX_ROOT,
+  /* Boundary between a function and the function that encloses it. */
+  LEX_FUNCTION,
+  /* A local variable. */
+  LEX_LOCAL,
+  /* A variable of a let-form that is referenced through a box while the
+   * values of the let-form are evaluated. */
+  LEX_BOX,
+} LexScopeType;
+
+/* The cases of a match-form that can match data with a given constructor
+ * tag. */
+struct MatchBranch {
+  /* Indices of the cases in order. */
+  size_t size;
+  size_t *cases;
+};
+
+/* The formal parameters of a function or a recur-form. */
+struct Parameters {
+  size_t size;
+  Param *params;
+  /* Hash table from keywords to named parameters, NULL if there are none. An
+   * entry is the index of a parameter plus one, or 0 if the entry is empty. */
+  size_t *key_table;
+  /* Size of `key_table` minus one. The size is a power of two. */
+  size_t key_mask;
+};
+
+struct Code {
+  /* Type of code. */
+  CodeType type;
+  /* Optional source form used for error reporting. */
+  Syntax *form;
+  union {
+    /* CODE_CONST */
+    NseVal constant;
+    /* CODE_LOCAL / CODE_ENV / CODE_GLOBAL / CODE_BINDING */
+    struct {
+      Symbol *symbol;
+      /* Slot of CODE_LOCAL, environment index of CODE_ENV. */
+      size_t index;
+      /* 1 if the slot or environment entry holds a box. */
+      int boxed;
+      /* Definition box of CODE_GLOBAL, NULL if the symbol has no module. */
+      NseVal *global;
+      /* Binding of CODE_BINDING. */
+      Binding *binding;
+    } var;
+    /* CODE_TYPE_QUOTE */
+    struct {
+      Code *body;
+      size_t frame_size;
+    } type_quote;
+    /* CODE_TRY */
+    Code *body;
+    /* CODE_IF */
+    struct {
+      Code *condition;
+      Code *consequent;
+      Code *alternative;
+    } if_;
+    /* CODE_DO */
+    struct {
+      size_t size;
+      Code **statements;
+      /* Slots assigned by `(let SYMBOL EXPR)` statements. */
+      size_t *slots;
+      /* 1 for `(let SYMBOL EXPR)` statements, 0 for other statements. */
+      int *bind;
+    } block;
+    /* CODE_LET */
+    struct {
+      size_t size;
+      Pattern **patterns;
+      /* Box slots of patterns that are symbols. */
+      size_t *slots;
+      /* 1 if a box is needed for the pattern, -1 if the pattern is a symbol
+       * that is not referenced by the values, 0 if the pattern is not a
+       * symbol. */
+      int *boxes;
+      Code **values;
+      Code *body;
+    } let;
+    /* CODE_MATCH */
+    struct {
+      Code *value;
+      size_t size;
+      Pattern **patterns;
+      Code **bodies;
+      /* Branches indexed by the constructor tags tested by the cases, not
+       * initialized if no case tests a tag. */
+      BranchMap branches;
+      /* Cases that can match data with a tag that no case tests. */
+      MatchBranch other_tags;
+    } match;
+    /* CODE_FN / CODE_DEF_FUNC / CODE_DEF_MACRO */
+    struct {
+      /* Name of function, NULL for CODE_FN. */
+      Symbol *name;
+      /* Reference to a `Lambda`. */
+      NseVal lambda;
+      /* Closure type. */
+      CType *type;
+      /* Optional documentation string. */
+      String *doc;
+    } fn;
+    /* CODE_CALL / CODE_MACRO / CODE_CONTINUE / CODE_TAIL_CONS */
+    struct {
+      /* Operator, NULL for CODE_MACRO and CODE_CONTINUE. */
+      Code *function;
+      size_t size;
+      Code **args;
+      /* Tail of a dotted argument list, e.g. `xs` in `(f x . xs)`, or NULL. */
+      Code *rest;
+      /* Operator name if the operator is a symbol, otherwise NULL. */
+      Symbol *name;
+      /* Unevaluated arguments, passed to the macro if `name` names a macro. */
+      NseVal macro_args;
+      /* Lexical scope of the call if `name` is set, used for compiling the
+       * macro expansion. */
+      LexScope *scope;
+      /* Cached macro expansion of the call or NULL. */
+      Expansion *expansion;
+    } call;
+    /* CODE_RECUR */
+    struct {
+      Parameters parameters;
+      /* Initial values of the variables bound by the parameters, i.e. the
+       * variables with the same names in the enclosing scope. */
+      size_t init_size;
+      size_t *init_slots;
+      Code **inits;
+      Code *body;
+    } recur;
+    /* CODE_LOOP */
+    struct {
+      size_t size;
+      LoopIns *ins;
+    } loop;
+    /* CODE_DEF_VAR / CODE_DEF_READ_MACRO */
+    struct {
+      Symbol *name;
+      Code *value;
+    } def;
+    /* CODE_SPECIAL */
+    struct {
+      NseVal (*f)(NseVal, Scope *);
+      NseVal args;
+      /* Local variables visible to `f`. */
+      size_t size;
+      Symbol **names;
+      Code **vars;
+      /* Lexical scope of the form. */
+      LexScope *scope;
+    } special;
+  };
+};
+
+/* The compiled expansion of a macro call. The expansion is valid as long as
+ * `version` is equal to the `macro` field of the macro name. */
+struct Expansion {
+  Code *code;
+  size_t frame_size;
+  unsigned int version;
+  /* Number of active executions of `code`. */
+  int active;
+};
+
+struct LoopIns {
+  LoopInsType type;
+  /* Pattern of LOOP_FOR and LOOP_LET, otherwise NULL. */
+  Pattern *pattern;
+  Code *code;
+};
+
+struct Pattern {
+  PatternType type;
+  /* Optional source form used for error reporting. */
+  Syntax *form;
+  union {
+    /* PATTERN_BIND */
+    size_t slot;
+    /* PATTERN_LITERAL / PATTERN_QUOTE */
+    struct {
+      NseVal value;
+      /* Quoted symbol, NULL if the quoted datum is not a symbol. */
+      Symbol *tag;
+    } literal;
+    /* PATTERN_CONS */
+    struct {
+      Pattern *head;
+      Pattern *tail;
+    } cons;
+  };
+};
+
+/* A formal parameter. The parameters of a function are analysed once when the
+ * function is compiled, so binding arguments, including named arguments, does
+ * not parse the formal list, intern keywords or allocate. */
+struct Param {
+  ParamType type;
+  /* Pattern of PARAM_REQUIRED. */
+  Pattern *pattern;
+  /* Slot of PARAM_OPTIONAL, PARAM_KEY and PARAM_REST. */
+  size_t slot;
+  /* Keyword of PARAM_KEY. */
+  Symbol *keyword;
+  /* Optional default value of PARAM_OPTIONAL and PARAM_KEY. */
+  Code *default_value;
+};
+
+/* A free variable of a function, copied into the environment of a closure
+ * when it is created. */
+struct Capture {
+  /* 1 if the variable is in the environment of the closure that creates the
+   * closure, 0 if it is in a slot of the frame that creates the closure. */
+  int env;
+  /* Slot or environment index of the variable. */
+  size_t index;
+};
+
+/* A compiled function. */
+struct Lambda {
+  Parameters parameters;
+  Code *body;
+  /* Number of slots in a frame of the function. */
+  size_t frame_size;
+  /* Size of the environment of closures of the function, i.e. the lambda
+   * followed by the captured variables. */
+  size_t env_size;
+  Capture *captures;
+  /* Module that the function was compiled in. */
+  Module *module;
+  /* 1 if the body may return a continue-form that restarts the function or
+   * contains CODE_TAIL_CONS (see `optimize_tail_call()`). */
+  int loop;
+};
+
+/* A reference counted list of lexical scopes. A scope is kept alive by the
+ * scopes above it and by the code nodes that refer to it. */
+struct LexScope {
+  size_t refs;
+  LexScopeType type;
+  /* Name of LEX_LOCAL and LEX_BOX. */
+  Symbol *symbol;
+  /* Number of slots in use in the current function, i.e. the slot of a
+   * LEX_LOCAL or LEX_BOX is `size - 1`. */
+  size_t size;
+  /* Number of references to a LEX_BOX. */
+  size_t uses;
+  /* Free variables of LEX_FUNCTION. */
+  size_t captures_size;
+  Capture *captures;
+  /* Set when the function of LEX_FUNCTION has been compiled, after which no
+   * more variables can be captured. */
+  int sealed;
+  /* Scope of LEX_ROOT. */
+  Scope *runtime;
+  /* Namespace of global variables of LEX_ROOT. */
+  ScopeType namespace;
+  LexScope *next;
+};
+
+/* State of the function being compiled. */
+struct Compiler {
+  /* Innermost lexical scope. */
+  LexScope *scope;
+  /* Number of slots needed so far. */
+  size_t frame_size;
+  /* Module of the code being compiled. */
+  Module *module;
+  /* Number of macro expansions being compiled. */
+  int expansions;
+};
+
+/* Initializes a compiler for code evaluated in `scope`. Returns 0 if
+ * allocation fails. */
+int init_compiler(Compiler *c, Scope *scope);
+/* Initializes a compiler for code evaluated within the lexical scope `scope`
+ * of a function, e.g. a macro expansion. */
+void init_nested_compiler(Compiler *c, LexScope *scope, Module *module);
+void delete_compiler(Compiler *c);
+
+/* Compiles a form. Raises an error and returns NULL on syntax errors or if
+ * allocation fails. */
+Code *compile(NseVal form, Compiler *c);
+/* Compiles a sequence of statements. */
+Code *compile_block(NseVal block, Compiler *c);
+/* Compiles an application of `operator` to `args`. If `strict` is 0 and the
+ * operator is a symbol, arguments that fail to compile result in a CODE_MACRO
+ * node, since a macro defined later may still accept them. */
+Code *compile_call(NseVal operator, NseVal args, int strict, Compiler *c);
+/* Compiles the arguments of a call or a continue-form. */
+int compile_arguments(Code *code, NseVal args, Compiler *c);
+/* Compiles a pattern and adds the variables bound by it to the scope. */
+Pattern *compile_pattern(NseVal pattern, Compiler *c);
+/* Compiles a formal parameter list and adds the parameters to the scope.
+ * Returns 0 on error. */
+int compile_parameters(NseVal formal, Parameters *parameters, Compiler *c);
+/* Compiles a function with the given formal parameter list and body into a
+ * reference to a `Lambda`. Returns undefined on error. */
+NseVal compile_lambda(NseVal formal, NseVal body, Compiler *c);
+/* Adds a variable to the scope. The slot of the variable is `size - 1` of the
+ * returned scope. Returns NULL if allocation fails. */
+LexScope *compile_push(Compiler *c, LexScopeType type, Symbol *symbol);
+/* Removes variables from the scope until `scope` is the innermost scope. */
+void compile_pop_until(Compiler *c, LexScope *scope);
+/* Resolves a variable reference. */
+Code *compile_variable(Symbol *symbol, Compiler *c);
+/* Deletes a code tree. */
+void delete_code(Code *code);
+void delete_pattern(Pattern *pattern);
+void delete_parameters(Parameters *parameters);
+LexScope *copy_lex_scope(LexScope *scope);
+void delete_lex_scope(LexScope *scope);
+/* Replaces self-calls in tail position of the body of `lambda` with
+ * continue-forms and marks the lambda as a loop if any were found. Calls to
+ * `cons` in tail position whose second argument is a self-call become
+ * CODE_TAIL_CONS, which builds the list front to back in a loop. Tail
+ * positions are found through if, do, let, match and the expansions of macro
+ * calls that were expanded at compile time. Returns the number of self-calls
+ * that were replaced with continue-forms. */
+size_t optimize_tail_call(Lambda *lambda, Symbol *name);
+
+/* Allocates a code node of the given type. The `form` is implicitly copied. */
+Code *create_code(CodeType type, NseVal form);
+/* Allocates a zero-initialized array of `size` code pointers. */
+Code **create_code_array(size_t size);
+
+#endif
@@ -2,37 +2,16 @@
 
 #include "runtime/value.h"
 #include "runtime/error.h"
+#include "runtime/cycle.h"
 #include "runtime/validate.h"
+#include "runtime/hashmap.h"
 #include "write.h"
 #include "special.h"
+#include "compile.h"
+#include "system.h"
 
 #include "eval.h"
 
-NseVal eval_list(NseVal list, Scope *scope) {
-  if (list.type->internal == INTERNAL_SYNTAX) {
-    Syntax *previous = push_debug_form(list.syntax);
-    return pop_debug_form(eval_list(list.syntax->quoted, scope), previous);
-  } else if (list.type->internal == INTERNAL_NIL) {
-    return nil;
-  } else if (list.type->internal == INTERNAL_CONS) {
-    NseVal result = undefined;
-    NseVal head = eval(list.cons->head, scope);
-    if (RESULT_OK(head)) {
-      NseVal tail = eval_list(list.cons->tail, scope);
-      if (RESULT_OK(tail)) {
-        Cons *cons = create_cons(head, tail);
-        if (cons != NULL) {
-          result = CONS(cons);
-        }
-        del_ref(tail);
-      }
-      del_ref(head);
-    }
-    return result;
-  }
-  return eval(list, scope);
-}
-
 CType *parameters_to_type(NseVal formal) {
   int ok = 1;
   int min_arity = 0;
@@ -97,226 +76,248 @@ CType *parameters_to_type(NseVal formal) {
   return get_closure_type(min_arity, variadic || key || optional);
 }
 
-struct named_parameter {
-  Symbol *keyword;
-  Symbol *symbol;
-  NseVal default_value;
-  int seen;
-  struct named_parameter *next;
+/* The slots of frames are allocated from a stack of chunks. Frames are
+ * created and deleted in LIFO order, so allocating and freeing the slots of a
+ * frame is usually just a matter of moving the top of the current chunk. */
+struct FrameChunk {
+  FrameChunk *next;
+  size_t size;
+  size_t top;
+  NseVal slots[];
 };
 
-void delete_named_parameters(struct named_parameter *stack) {
-  while (stack) {
-    struct named_parameter *next = stack->next;
-    free(stack);
-    stack = next;
+#define FRAME_CHUNK_SIZE 4096
+
+static FrameChunk *frame_stack = NULL;
+/* The most recently emptied chunk, kept to avoid reallocating a chunk when
+ * calls repeatedly cross a chunk boundary. */
+static FrameChunk *spare_chunk = NULL;
+
+static NseVal *push_slots(size_t size, FrameChunk **chunk) {
+  FrameChunk *top = frame_stack;
+  if (!top || top->top + size > top->size) {
+    if (spare_chunk && spare_chunk->size >= size) {
+      top = spare_chunk;
+      spare_chunk = NULL;
+    } else {
+      size_t chunk_size = size > FRAME_CHUNK_SIZE ? size : FRAME_CHUNK_SIZE;
+      top = allocate(sizeof(FrameChunk) + sizeof(NseVal) * chunk_size);
+      if (!top) {
+        return NULL;
+      }
+      top->size = chunk_size;
+    }
+    top->top = 0;
+    top->next = frame_stack;
+    frame_stack = top;
+  }
+  NseVal *slots = top->slots + top->top;
+  top->top += size;
+  *chunk = top;
+  return slots;
+}
+
+static void pop_slots(FrameChunk *chunk, size_t size) {
+  chunk->top -= size;
+  if (chunk->top == 0 && chunk == frame_stack) {
+    frame_stack = chunk->next;
+    if (spare_chunk) {
+      free(spare_chunk);
+    }
+    spare_chunk = chunk;
   }
 }
 
-int push_named_parameter(struct named_parameter **stack, Symbol *keyword, Symbol *symbol, NseVal default_value) {
-  struct named_parameter *new = allocate(sizeof(struct named_parameter));
-  if (!new) {
-    delete_named_parameters(*stack);
+int init_frame(Frame *frame, size_t size, NseVal *env, size_t env_size, Module *module) {
+  frame->slots = NULL;
+  frame->size = 0;
+  frame->chunk = NULL;
+  frame->env = env;
+  frame->env_size = env_size;
+  frame->module = module;
+  if (size == 0) {
+    return 1;
+  }
+  frame->slots = push_slots(size, &frame->chunk);
+  if (!frame->slots) {
     return 0;
   }
-  new->keyword = keyword;
-  new->symbol = symbol;
-  new->next = *stack;
-  new->default_value = default_value;
-  new->seen = 0;
-  *stack = new;
+  for (size_t i = 0; i < size; i++) {
+    frame->slots[i] = undefined;
+  }
+  frame->size = size;
   return 1;
 }
 
-Symbol *find_named_parameter(struct named_parameter *stack, Symbol *keyword) {
-  while (stack) {
-    if (stack->keyword == keyword) {
-      stack->seen = 1;
-      return stack->symbol;
-    }
-    stack = stack->next;
+void delete_frame(Frame *frame) {
+  for (size_t i = 0; i < frame->size; i++) {
+    del_ref(frame->slots[i]);
   }
-  return NULL;
+  if (frame->chunk) {
+    pop_slots(frame->chunk, frame->size);
+  } else {
+    free(frame->slots);
+  }
+  frame->slots = NULL;
+  frame->size = 0;
+  frame->chunk = NULL;
 }
 
-int assign_named_parameters(Scope **scope, NseVal formal, NseVal actual) {
-  int result = 1;
-  struct named_parameter *params = NULL;
-  while (is_cons(formal)) {
-    Symbol *symbol;
-    NseVal default_value = undefined;
-    if (is_cons(head(formal))) {
-      symbol = to_symbol(head(head(formal)));
-      default_value = elem(1, head(formal));
-      if (!RESULT_OK(default_value)) {
-        set_debug_form(tail(head(formal)));
-        raise_error(domain_error, "expected a default value");
-        result = 0;
-        break;
-      }
+int grow_frame(Frame *frame, size_t size) {
+  if (size <= frame->size) {
+    return 1;
+  }
+  FrameChunk *chunk = frame->chunk;
+  if (frame->size == 0) {
+    return init_frame(frame, size, frame->env, frame->env_size, frame->module);
+  } else if (chunk && chunk->top + size - frame->size <= chunk->size) {
+    // The frame being executed is always at the top of the stack
+    chunk->top += size - frame->size;
+  } else {
+    NseVal *slots = allocate(sizeof(NseVal) * size);
+    if (!slots) {
+      return 0;
+    }
+    memcpy(slots, frame->slots, sizeof(NseVal) * frame->size);
+    if (chunk) {
+      pop_slots(chunk, frame->size);
     } else {
-      symbol = to_symbol(head(formal));
+      free(frame->slots);
     }
-    if (!symbol) {
-      raise_error(domain_error, "expected a symbol");
-      result = 0;
+    frame->slots = slots;
+    frame->chunk = NULL;
+  }
+  for (size_t i = frame->size; i < size; i++) {
+    frame->slots[i] = undefined;
+  }
+  frame->size = size;
+  return 1;
+}
+
+void set_slot(Frame *frame, size_t slot, NseVal value) {
+  NseVal old = frame->slots[slot];
+  frame->slots[slot] = add_ref(value);
+  del_ref(old);
+}
+
+NseVal get_variable(Code *code, Frame *frame) {
+  NseVal value = undefined;
+  switch (code->type) {
+    case CODE_LOCAL:
+      value = frame->slots[code->var.index];
       break;
-    }
-    Symbol *keyword = intern_keyword(symbol->name);
-    if (!push_named_parameter(&params, keyword, symbol, default_value)) {
-      result = 0;
+    case CODE_ENV:
+      value = frame->env[code->var.index];
       break;
-    }
-    formal = tail(formal);
-  }
-  if (result) {
-    while (is_cons(actual)) {
-      Symbol *keyword = to_keyword(head(actual));
-      if (!keyword) {
-        raise_error(domain_error, "expected a keyword");
-        result = 0;
-        break;
-      }
-      Symbol *symbol = find_named_parameter(params, keyword);
-      if (!symbol) {
-        raise_error(domain_error, "unknown named parameter: %s", keyword->name);
-        result = 0;
-        break;
-      }
-      NseVal value = elem(1, actual);
-      if (!RESULT_OK(value)) {
-        result = 0;
-        break;
-      }
-      *scope = scope_push(*scope, symbol, value);
-      actual = tail(tail(actual));
-    }
-    if (result) {
-      for (struct named_parameter *stack = params; stack; stack = stack->next) {
-        if (!stack->seen) {
-          if (RESULT_OK(stack->default_value)) {
-            NseVal default_value = eval(stack->default_value, *scope);
-            if (!RESULT_OK(default_value)) {
-              result = 0;
-              break;
-            }
-            *scope = scope_push(*scope, stack->symbol, default_value);
-          } else {
-            *scope = scope_push(*scope, stack->symbol, nil);
-          }
-        }
+    case CODE_GLOBAL:
+      if (code->var.global) {
+        value = *code->var.global;
       }
-    }
+      break;
+    case CODE_BINDING:
+      value = binding_value(code->var.binding);
+      break;
+    default:
+      break;
   }
-  delete_named_parameters(params);
-  return result;
+  if (code->var.boxed && RESULT_OK(value) && value.type == box_type) {
+    value = *(NseVal *)value.reference->pointer;
+  }
+  return value;
 }
 
-int assign_rest_parameters(Scope **scope, NseVal formal, NseVal actual) {
-  Cons *cons = to_cons(formal);
-  if (!cons || !is_nil(cons->tail)) {
-    raise_error(domain_error, "&rest must be followed by exactly one symbol");
-    return 0;
-  }
-  Symbol *name = to_symbol(cons->head);
-  if (!name) {
-    raise_error(domain_error, "&rest must be followed by exactly one symbol");
-    return 0;
+/* Finds the named parameter of `keyword` in the keyword table. */
+static Param *find_named_parameter(Parameters *parameters, Symbol *keyword) {
+  size_t mask = parameters->key_mask;
+  for (size_t i = pointer_hash(keyword) & mask; parameters->key_table[i]; i = (i + 1) & mask) {
+    Param *param = &parameters->params[parameters->key_table[i] - 1];
+    if (param->keyword == keyword) {
+      return param;
+    }
   }
-  *scope = scope_push(*scope, name, actual);
-  return 1;
+  return NULL;
 }
 
-int assign_opt_parameters(Scope **scope, NseVal formal, NseVal actual) {
-  while (is_cons(formal)) {
-    Symbol *symbol;
-    NseVal default_expr = undefined;
-    if (is_cons(head(formal))) {
-      symbol = to_symbol(head(head(formal)));
-      default_expr = elem(1, head(formal));
-      if (!RESULT_OK(default_expr)) {
-        raise_error(domain_error, "expected a default value");
-        return 0;
-      }
-    } else {
-      symbol = to_symbol(head(formal));
+/* Assigns the named parameters `parameters->params[start]` and onward. */
+static int assign_named_parameters(Parameters *parameters, size_t start, Slice actual, Frame *frame) {
+  Param *params = parameters->params + start;
+  size_t size = parameters->size - start;
+  for (size_t i = 0; i < size; i++) {
+    set_slot(frame, params[i].slot, undefined);
+  }
+  while (!slice_is_empty(actual)) {
+    NseVal name = slice_pop(&actual);
+    Symbol *keyword = RESULT_OK(name) ? to_keyword(name) : NULL;
+    if (!keyword) {
+      raise_error(domain_error, "expected a keyword");
+      return 0;
+    }
+    Param *param = find_named_parameter(parameters, keyword);
+    if (!param) {
+      raise_error(domain_error, "unknown named parameter: %s", keyword->name);
+      return 0;
     }
-    if (!symbol) {
-      raise_error(domain_error, "expected a symbol");
+    NseVal value = slice_pop(&actual);
+    if (!RESULT_OK(value)) {
+      raise_error(domain_error, "expected a value for named parameter: %s", keyword->name);
       return 0;
     }
-    if (symbol == key_keyword) {
-      return assign_named_parameters(scope, tail(formal), actual);
-    } else if (symbol == rest_keyword) {
-      return assign_rest_parameters(scope, tail(formal), actual);
+    set_slot(frame, param->slot, value);
+  }
+  for (size_t i = 0; i < size; i++) {
+    Param *param = &params[i];
+    if (RESULT_OK(frame->slots[param->slot])) {
+      continue;
     }
-    if (is_cons(actual)) {
-      *scope = scope_push(*scope, symbol, head(actual));
-      actual = tail(actual);
-    } else if (RESULT_OK(default_expr)) {
-      NseVal default_value = eval(default_expr, *scope);
+    if (param->default_value) {
+      NseVal default_value = exec(param->default_value, frame);
       if (!RESULT_OK(default_value)) {
         return 0;
       }
-      *scope = scope_push(*scope, symbol, default_value);
+      set_slot(frame, param->slot, default_value);
+      del_ref(default_value);
     } else {
-      *scope = scope_push(*scope, symbol, nil);
+      set_slot(frame, param->slot, nil);
     }
-    formal = tail(formal);
-  }
-  if (!is_nil(actual)) {
-    raise_error(pattern_error, "too many parameters for function");
-    return 0;
   }
   return 1;
 }
 
-int match_pattern(Scope **scope, NseVal pattern, NseVal actual) {
-  switch (pattern.type->internal) {
-    case INTERNAL_SYNTAX: {
-      Syntax *previous = push_debug_form(pattern.syntax);
-      if (match_pattern(scope, pattern.syntax->quoted, actual)) {
-        pop_debug_form(nil, previous);
-        return 1;
-      } else {
-        pop_debug_form(undefined, previous);
-        return 0;
-      }
-    }
-    case INTERNAL_SYMBOL:
-      *scope = scope_push(*scope, pattern.symbol, actual);
+static int match_pattern_form(Pattern *pattern, NseVal actual, Frame *frame) {
+  switch (pattern->type) {
+    case PATTERN_BIND:
+      set_slot(frame, pattern->slot, actual);
       return 1;
-    case INTERNAL_QUOTE:
+    case PATTERN_QUOTE:
       if (actual.type->internal == INTERNAL_DATA) {
-        Symbol *tag = to_symbol(pattern.quote->quoted);
-        if (tag == actual.data->tag && actual.data->record_size == 0) {
+        if (pattern->literal.tag == actual.data->tag && actual.data->record_size == 0) {
           return 1;
         }
       }
-      if (!is_true(nse_equals(pattern.quote->quoted, actual))) {
+      if (!is_true(nse_equals(pattern->literal.value, actual))) {
         raise_error(pattern_error, "pattern match failed");
         return 0;
       }
       return 1;
-    case INTERNAL_CONS: {
-      if (actual.type->internal == INTERNAL_DATA && is_quote(head(pattern))) {
-        Symbol *tag = to_symbol(strip_syntax(head(pattern)).quote->quoted);
-        if (tag == actual.data->tag) {
-          NseVal next = tail(pattern);
+    case PATTERN_CONS: {
+      Pattern *h = pattern->cons.head;
+      if (actual.type->internal == INTERNAL_DATA && h->type == PATTERN_QUOTE) {
+        if (h->literal.tag == actual.data->tag) {
+          Pattern *next = pattern->cons.tail;
           int match = 1;
           for (int i = 0; i < actual.data->record_size; i++) {
-            if (!is_cons(next)) {
+            if (next->type != PATTERN_CONS) {
               match = 0;
               break;
             }
-            if (!match_pattern(scope, head(next), actual.data->record[i])) {
+            if (!match_pattern(next->cons.head, actual.data->record[i], frame)) {
               match = 0;
               break;
             }
-            next = tail(next);
+            next = next->cons.tail;
           }
           if (match) {
-            if (!is_nil(next)) {
+            if (next->type != PATTERN_NIL) {
               set_debug_form(actual);
               raise_error(pattern_error, "pattern match failed");
               return 0;
@@ -332,320 +333,700 @@ int match_pattern(Scope **scope, NseVal pattern, NseVal actual) {
         raise_error(pattern_error, "expected list");
         return 0;
       }
-      return match_pattern(scope, head(pattern), head(actual))
-        && match_pattern(scope, tail(pattern), tail(actual));
+      return match_pattern(h, head(actual), frame)
+        && match_pattern(pattern->cons.tail, tail(actual), frame);
     }
-    case INTERNAL_NIL:
+    case PATTERN_NIL:
       if (!is_nil(actual)) {
         set_debug_form(actual);
         raise_error(pattern_error, "too many parameters for function");
         return 0;
       }
       return 1;
-    case INTERNAL_I64:
-    case INTERNAL_F64:
-      if (!is_true(nse_equals(pattern, actual))) {
+    case PATTERN_LITERAL:
+      if (!is_true(nse_equals(pattern->literal.value, actual))) {
         raise_error(pattern_error, "pattern match failed");
         return 0;
       }
       return 1;
+    case PATTERN_INVALID:
     default:
       // not ok
       return 0;
   }
 }
 
-int assign_parameters(Scope **scope, NseVal formal, NseVal actual) {
-  while (is_cons(formal)) {
-    NseVal h = head(formal);
-    Symbol *param = to_symbol(head(formal));
-    if (!param) {
-      set_debug_form(h);
-      raise_error(syntax_error, "expected a symbol");
+int match_pattern(Pattern *pattern, NseVal actual, Frame *frame) {
+  if (!pattern->form) {
+    return match_pattern_form(pattern, actual, frame);
+  }
+  Syntax *previous = push_debug_form(pattern->form);
+  if (match_pattern_form(pattern, actual, frame)) {
+    pop_debug_form(nil, previous);
+    return 1;
+  } else {
+    pop_debug_form(undefined, previous);
+    return 0;
+  }
+}
+
+int try_match_fields(Pattern *fields, Data *data, Frame *frame) {
+  if (!fields) {
+    return data->record_size == 0;
+  }
+  for (size_t i = 0; i < data->record_size; i++) {
+    if (fields->type != PATTERN_CONS || !try_match_pattern(fields->cons.head, data->record[i], frame)) {
       return 0;
     }
-    if (param == key_keyword) {
-      return assign_named_parameters(scope, tail(formal), actual);
-    } else if (param == opt_keyword) {
-      return assign_opt_parameters(scope, tail(formal), actual);
-    } else if (param == rest_keyword) {
-      return assign_rest_parameters(scope, tail(formal), actual);
+    fields = fields->cons.tail;
+  }
+  return fields->type == PATTERN_NIL;
+}
+
+int try_match_pattern(Pattern *pattern, NseVal actual, Frame *frame) {
+  switch (pattern->type) {
+    case PATTERN_BIND:
+      set_slot(frame, pattern->slot, actual);
+      return 1;
+    case PATTERN_QUOTE:
+      if (actual.type->internal == INTERNAL_DATA && pattern->literal.tag == actual.data->tag
+          && actual.data->record_size == 0) {
+        return 1;
+      }
+      return is_true(nse_equals(pattern->literal.value, actual));
+    case PATTERN_CONS: {
+      Pattern *h = pattern->cons.head;
+      if (actual.type->internal == INTERNAL_DATA && h->type == PATTERN_QUOTE) {
+        return h->literal.tag == actual.data->tag && try_match_fields(pattern->cons.tail, actual.data, frame);
+      } else if (!is_cons(actual)) {
+        return 0;
+      }
+      return try_match_pattern(h, head(actual), frame) && try_match_pattern(pattern->cons.tail, tail(actual), frame);
     }
-    if (!is_cons(actual)) {
-      set_debug_form(actual);
+    case PATTERN_NIL:
+      return is_nil(actual);
+    case PATTERN_LITERAL:
+      return is_true(nse_equals(pattern->literal.value, actual));
+    case PATTERN_INVALID:
+    default:
+      return 0;
+  }
+}
+
+int assign_parameters(Parameters *parameters, Slice actual, Frame *frame) {
+  Param *params = parameters->params;
+  size_t size = parameters->size;
+  size_t i = 0;
+  for (; i < size && params[i].type == PARAM_REQUIRED; i++) {
+    NseVal value = slice_pop(&actual);
+    if (!RESULT_OK(value)) {
       raise_error(domain_error, "too few parameters for function");
       return 0;
     }
-    NseVal next = head(actual);
-    if (param == match_keyword) {
-      formal = tail(formal);
-      Cons *cons = to_cons(formal);
-      if (!cons) {
-        set_debug_form(formal);
-        raise_error(syntax_error, "&match must be followed by a pattern");
-        return 0;
-      }
-      if (!match_pattern(scope, cons->head, next)) {
+    if (!match_pattern(params[i].pattern, value, frame)) {
+      return 0;
+    }
+  }
+  int optional = 0;
+  for (; i < size && params[i].type == PARAM_OPTIONAL; i++) {
+    optional = 1;
+    NseVal value = slice_pop(&actual);
+    if (RESULT_OK(value)) {
+      set_slot(frame, params[i].slot, value);
+    } else if (params[i].default_value) {
+      NseVal default_value = exec(params[i].default_value, frame);
+      if (!RESULT_OK(default_value)) {
         return 0;
       }
+      set_slot(frame, params[i].slot, default_value);
+      del_ref(default_value);
     } else {
-      *scope = scope_push(*scope, param, next);
+      set_slot(frame, params[i].slot, nil);
     }
-    formal = tail(formal);
-    actual = tail(actual);
   }
-  if (!is_nil(formal)) {
-    set_debug_form(formal);
-    raise_error(syntax_error, "formal parameters must be a proper list");
-    return 0;
+  if (i < size) {
+    if (params[i].type == PARAM_REST) {
+      NseVal rest = slice_to_list(actual);
+      if (!RESULT_OK(rest)) {
+        return 0;
+      }
+      set_slot(frame, params[i].slot, rest);
+      del_ref(rest);
+      return 1;
+    }
+    return assign_named_parameters(parameters, i, actual, frame);
   }
-  if (!is_nil(actual)) {
-    set_debug_form(actual);
-    raise_error(domain_error, "too many parameters for function");
+  if (!slice_is_empty(actual)) {
+    if (optional) {
+      raise_error(pattern_error, "too many parameters for function");
+    } else {
+      NseVal extra = slice_pop(&actual);
+      if (RESULT_OK(extra)) {
+        set_debug_form(extra);
+      }
+      raise_error(domain_error, "too many parameters for function");
+    }
     return 0;
   }
   return 1;
 }
 
-NseVal eval_block(NseVal block, Scope *scope) {
-  NseVal result = nil;
-  Scope *current_scope = scope;
-  while (is_cons(block)) {
-    del_ref(result);
-    result = nil;
-    NseVal statement = head(block);
-    Symbol *name = NULL;
-    NseVal expr = undefined;
-    if (VALIDATE(statement, V_EXACT(let_symbol), V_SYMBOL(&name), V_ANY(&expr))) {
-      NseVal value = eval(expr, current_scope);
-      if (!RESULT_OK(value)) {
-        result = value;
+int assign_parameter_list(Parameters *parameters, NseVal actual, Frame *frame) {
+  return assign_parameters(parameters, SLICE_REST(NULL, 0, actual), frame);
+}
+
+#define ARGUMENT_BUFFER_SIZE 8
+
+typedef enum {
+  TAIL_NONE,
+  TAIL_CALL,
+  TAIL_CONTINUE,
+} TailType;
+
+/* A call or continue-form in tail position of a lambda body or a recur-form.
+ * A call to another lambda is made by `eval_anon()` after the frame of the
+ * calling lambda has been deleted, so that tail calls run in constant stack
+ * space. The arguments of a continue-form are assigned to the parameters of
+ * the enclosing loop in place. */
+typedef struct {
+  TailType pending;
+  /* 1 if calls may be left to `eval_anon()`. */
+  int calls;
+  /* 1 if a continue-form restarts the body. */
+  int loop;
+  /* Function of TAIL_CALL. */
+  NseVal function;
+  Slice args;
+  NseVal buffer[ARGUMENT_BUFFER_SIZE];
+  /* List built by CODE_TAIL_CONS and the tail of its last cons, which the
+   * result of the loop is stored in. NULL if no list has been started. */
+  NseVal list;
+  NseVal *destination;
+} TailCall;
+
+static void release_arguments(Slice args, NseVal buffer[]);
+static NseVal exec_code(Code *code, Frame *frame, TailCall *tail);
+
+/* Executes the body of a lambda or a recur-form until it returns something
+ * other than a continue-form. Returns undefined with `tail->pending` set to
+ * TAIL_CALL if the body ends with a call that is left to `eval_anon()`. */
+static NseVal exec_loop_body(Code *body, Parameters *parameters, Frame *frame, TailCall *tail) {
+  int calls = tail->calls;
+  tail->destination = NULL;
+  NseVal result;
+  while (1) {
+    result = exec_code(body, frame, tail);
+    if (tail->pending == TAIL_CONTINUE) {
+      tail->pending = TAIL_NONE;
+      int ok = assign_parameters(parameters, tail->args, frame);
+      release_arguments(tail->args, tail->buffer);
+      if (!ok) {
+        result = undefined;
         break;
       }
-      current_scope = scope_push(current_scope, name, value);
-      del_ref(value);
+      continue;
+    }
+    if (!tail->loop || !RESULT_OK(result) || result.type != continue_type) {
+      break;
+    }
+    // A continue-form that was not in tail position
+    int ok = assign_parameter_list(parameters, result.quote->quoted, frame);
+    del_ref(result);
+    if (!ok) {
+      result = undefined;
+      break;
+    }
+  }
+  if (tail->destination) {
+    if (RESULT_OK(result)) {
+      *tail->destination = result;
+      result = tail->list;
     } else {
-      result = eval(statement, current_scope);
-      if (!RESULT_OK(result)) {
-        break;
-      }
+      del_ref(tail->list);
     }
-    block = tail(block);
+    tail->destination = NULL;
+    tail->calls = calls;
   }
-  scope_pop_until(current_scope, scope);
   return result;
 }
 
-NseVal eval_anon(NseVal args, NseVal env[]) {
-  NseVal definition = env[0];
-  Scope *scope = env[1].reference->pointer;
-  NseVal formal = head(definition);
-  Scope *current_scope = scope;
+NseVal eval_anon(Slice args, NseVal env[]) {
+  TailCall tail;
+  tail.pending = TAIL_NONE;
+  tail.calls = 1;
+  // The lambda of the current tail call
+  NseVal function = undefined;
   NseVal result = undefined;
-  if (assign_parameters(&current_scope, formal, args)) {
-    result = eval_block(tail(definition), current_scope);
+  while (1) {
+    Lambda *lambda = env[0].reference->pointer;
+    Frame frame;
+    int ok = init_frame(&frame, lambda->frame_size, env, lambda->env_size, lambda->module)
+      && assign_parameters(&lambda->parameters, args, &frame);
+    if (RESULT_OK(function)) {
+      release_arguments(args, tail.buffer);
+    }
+    result = undefined;
+    if (ok) {
+      // A self-call in tail position is a continue-form, see
+      // `optimize_tail_call()`
+      tail.loop = lambda->loop;
+      result = exec_loop_body(lambda->body, &lambda->parameters, &frame, &tail);
+    }
+    delete_frame(&frame);
+    if (tail.pending != TAIL_CALL) {
+      break;
+    }
+    tail.pending = TAIL_NONE;
+    del_ref(function);
+    function = tail.function;
+    env = function.closure->env;
+    args = tail.args;
   }
-  scope_pop_until(current_scope, scope);
+  del_ref(function);
+  // Every value that is in use further up the stack is referenced by a frame,
+  // an argument list or a pending result, so returning is a safe point
+  collect_cycles_if_needed();
   return result;
 }
 
-NseVal eval_anon_type(NseVal args, NseVal env[]) {
-  NseVal name = env[2];
-  Scope *scope = env[1].reference->pointer;
-  NseVal name_cons = check_alloc(CONS(create_cons(name, args)));
-  if (!RESULT_OK(name_cons)) {
-    return undefined;
+static void release_arguments(Slice args, NseVal buffer[]) {
+  for (size_t i = 0; i < args.length; i++) {
+    del_ref(args.cells[i]);
   }
-  NseVal name_datum = syntax_to_datum(name_cons);
-  del_ref(name_cons);
-  if (!RESULT_OK(name_datum)) {
-    return undefined;
+  del_ref(args.rest);
+  if (args.cells != buffer) {
+    free(args.cells);
   }
-  NseVal result = eval_anon(args, env);
-  if (RESULT_OK(result)) {
-    if (is_type(result)) {
-      CType *t = to_type(result);
-      del_ref(result);
-      result = TYPE(t);
+}
+
+/* Evaluates the arguments of a call or a continue-form into `buffer`, or into
+ * an allocated array if the buffer is too small. The tail of a dotted argument
+ * list becomes the rest of the slice. The arguments must be released with
+ * `release_arguments()`. Returns 0 on error. */
+static int exec_arguments(Code *code, Frame *frame, NseVal buffer[], Slice *args) {
+  NseVal *values = buffer;
+  if (code->call.size > ARGUMENT_BUFFER_SIZE) {
+    values = allocate(sizeof(NseVal) * code->call.size);
+    if (!values) {
+      return 0;
     }
   }
-  del_ref(name_datum);
-  return result;
+  size_t evaluated = 0;
+  int ok = 1;
+  for (; evaluated < code->call.size; evaluated++) {
+    values[evaluated] = exec(code->call.args[evaluated], frame);
+    if (!RESULT_OK(values[evaluated])) {
+      ok = 0;
+      break;
+    }
+  }
+  NseVal rest = nil;
+  if (ok && code->call.rest) {
+    rest = exec(code->call.rest, frame);
+    if (!RESULT_OK(rest)) {
+      rest = nil;
+      ok = 0;
+    } else if (!is_proper_list(rest)) {
+      raise_error(domain_error, "parameter list must be a proper list");
+      del_ref(rest);
+      rest = nil;
+      ok = 0;
+    }
+  }
+  *args = SLICE_REST(values, evaluated, rest);
+  if (!ok) {
+    release_arguments(*args, buffer);
+  }
+  return ok;
 }
 
-NseVal optimize_tail_call_cons(Cons *cons, Symbol *name) {
-  NseVal operator = cons->head;
-  NseVal args = cons->tail;
-  Symbol *macro_name = to_symbol(operator);
-  if (macro_name) {
-    if (macro_name == name) {
-      //printf("optimizing tail call: %s\n", name->name);
-      cons->head = add_ref(SYMBOL(continue_symbol));
-      del_ref(operator);
-      return TRUE;
-    } else if (macro_name == if_symbol) {
-      NseVal consequent = optimize_tail_call_any(elem(1, args), name);
-      NseVal alternative = THEN(consequent, optimize_tail_call_any(elem(2, args), name));
-      if (RESULT_OK(alternative)) {
-        return is_true(consequent) ? TRUE : alternative;
-      }
-      return alternative;
-    }
+/* Compiles a form within the lexical scope of a call. */
+static Code *compile_in_scope(NseVal form, Code *code, Module *module, int strict, size_t *frame_size) {
+  Compiler c;
+  init_nested_compiler(&c, code->call.scope, module);
+  Code *compiled;
+  if (strict) {
+    compiled = compile_call(SYMBOL(code->call.name), form, 1, &c);
+  } else {
+    compiled = compile(form, &c);
   }
-  return FALSE;
+  *frame_size = c.frame_size;
+  delete_compiler(&c);
+  return compiled;
 }
 
-NseVal optimize_tail_call_any(NseVal code, Symbol *name) {
-  if (!code.type) {
-    return code;
+/* Compiles and executes a form within the lexical scope of a call. */
+static NseVal exec_in_scope(NseVal form, Code *code, Frame *frame, int strict) {
+  size_t frame_size;
+  Code *compiled = compile_in_scope(form, code, frame->module, strict, &frame_size);
+  if (!compiled) {
+    return undefined;
   }
-  switch (code.type->internal) {
-    case INTERNAL_CONS:
-      return optimize_tail_call_cons(code.cons, name);
-    case INTERNAL_I64:
-    case INTERNAL_F64:
-    case INTERNAL_STRING:
-    case INTERNAL_QUOTE:
-    case INTERNAL_SYMBOL:
-      return FALSE;
-    case INTERNAL_SYNTAX: {
-      Syntax *previous = push_debug_form(code.syntax);
-      return pop_debug_form(optimize_tail_call_any(code.syntax->quoted, name), previous);
-    }
-    default:
-      raise_error(domain_error, "unexpected value type: %s", ""); // TOOD: type_to_str
-      return undefined;
+  NseVal result = undefined;
+  if (grow_frame(frame, frame_size)) {
+    result = exec(compiled, frame);
   }
+  delete_code(compiled);
+  return result;
 }
 
-Closure *optimize_tail_call(Closure *closure, Symbol *name) {
-  if (closure->env_size != 2) { // FIXME
-    return closure;
-  }
-  Cons *definition = to_cons(closure->env[0]);
-  if (!definition) {
-    return closure;
-  }
-  NseVal body = head(definition->tail);
-  NseVal result = optimize_tail_call_any(body, name);
-  if (RESULT_OK(result)) {
-    if (is_true(result)) {
-      NseVal loop1 = check_alloc(CONS(create_cons(body, nil)));
-      NseVal loop2 = THEN(loop1, check_alloc(CONS(create_cons(definition->head, loop1))));
-      del_ref(loop1);
-      NseVal loop3 = THEN(loop2, check_alloc(CONS(create_cons(SYMBOL(recur_symbol), loop2))));
-      del_ref(loop2);
-      NseVal new_tail = THEN(loop3, check_alloc(CONS(create_cons(loop3, nil))));
-      del_ref(loop3);
-      if (RESULT_OK(new_tail)) {
-        NseVal old_tail = definition->tail;
-        definition->tail = new_tail;
-        del_ref(old_tail);
-      } else {
-        del_ref(CLOSURE(closure));
-        return NULL;
-      }
+/* Executes the expansion of a macro call. The compiled expansion is cached in
+ * the call until the macro is redefined. */
+static NseVal exec_macro_expansion(NseVal macro_function, Code *code, Frame *frame, TailCall *tail) {
+  Expansion *expansion = code->call.expansion;
+  if (!expansion || expansion->version != code->call.name->macro) {
+    NseVal expanded = nse_apply(macro_function, code->call.macro_args);
+    if (!RESULT_OK(expanded)) {
+      return expanded;
     }
-  }
-  return closure;
-}
-
-NseVal eval_cons(Cons *cons, Scope *scope) {
-  NseVal operator = cons->head;
-  NseVal args = cons->tail;
-  Symbol *macro_name = to_symbol(operator);
-  if (macro_name) {
-    if (macro_name == if_symbol) {
-      return eval_if(args, scope);
-    } else if (macro_name == let_symbol) {
-      return eval_let(args, scope);
-    } else if (macro_name == match_symbol) {
-      return eval_match(args, scope);
-    } else if (macro_name == do_symbol) {
-      return eval_block(args, scope);
-    } else if (macro_name == fn_symbol) {
-      return eval_fn(args, scope);
-    } else if (macro_name == try_symbol) {
-      return eval_try(args, scope);
-    } else if (macro_name == continue_symbol) {
-      return eval_continue(args, scope);
-    } else if (macro_name == recur_symbol) {
-      return eval_recur(args, scope);
-    } else if (macro_name == def_symbol) {
-      return eval_def(args, scope);
-    } else if (macro_name == def_read_macro_symbol) {
-      return eval_def_read_macro(args, scope);
-    } else if (macro_name == def_type_symbol) {
-      return eval_def_type(args, scope);
-    } else if (macro_name == def_data_symbol) {
-      return eval_def_data(args, scope);
-    } else if (macro_name == def_macro_symbol) {
-      return eval_def_macro(args, scope);
-    } else if (macro_name == def_generic_symbol) {
-      return eval_def_generic(args, scope);
-    } else if (macro_name == def_method_symbol) {
-      return eval_def_method(args, scope);
-    } else if (macro_name == loop_symbol) {
-      return eval_loop(args, scope);
-    }
-    NseVal macro_function = scope_get_macro(scope, macro_name);
-    if (RESULT_OK(macro_function)) {
+    size_t frame_size;
+    Code *compiled = compile_in_scope(expanded, code, frame->module, 0, &frame_size);
+    del_ref(expanded);
+    if (!compiled) {
+      return undefined;
+    }
+    if (expansion && expansion->active) {
+      // The previous expansion is still being executed further up the stack,
+      // so it can't be replaced
       NseVal result = undefined;
-      NseVal expanded = nse_apply(macro_function, args);
-      if (!RESULT_OK(expanded)) {
-        return expanded;
+      if (grow_frame(frame, frame_size)) {
+        result = exec_code(compiled, frame, tail);
       }
-      result = eval(expanded, scope);
-      del_ref(expanded);
+      delete_code(compiled);
       return result;
     }
+    if (!expansion) {
+      expansion = allocate(sizeof(Expansion));
+      if (!expansion) {
+        delete_code(compiled);
+        return undefined;
+      }
+      expansion->active = 0;
+      code->call.expansion = expansion;
+    } else {
+      delete_code(expansion->code);
+    }
+    expansion->code = compiled;
+    expansion->frame_size = frame_size;
+    expansion->version = code->call.name->macro;
+  }
+  if (!grow_frame(frame, expansion->frame_size)) {
+    return undefined;
+  }
+  expansion->active++;
+  NseVal result = exec_code(expansion->code, frame, tail);
+  expansion->active--;
+  return result;
+}
+
+/* Evaluates a call. If `tail` is not NULL the call is in tail position of a
+ * lambda body, and a call to a lambda is left to `eval_anon()`. */
+static NseVal exec_call(Code *code, Frame *frame, TailCall *tail) {
+  if (code->call.name) {
+    NseVal macro_function = find_macro(code->call.name);
+    if (RESULT_OK(macro_function)) {
+      return exec_macro_expansion(macro_function, code, frame, tail);
+    }
   }
   NseVal result = undefined;
-  NseVal function = eval(operator, scope);
+  NseVal function = exec(code->call.function, frame);
   if (RESULT_OK(function)) {
-    NseVal arg_list = eval_list(args, scope);
+    if (tail && tail->calls && function.type->internal == INTERNAL_CLOSURE
+        && function.closure->f == eval_anon) {
+      if (exec_arguments(code, frame, tail->buffer, &tail->args)) {
+        tail->function = function;
+        tail->pending = TAIL_CALL;
+        return undefined;
+      }
+      del_ref(function);
+      return undefined;
+    }
+    NseVal buffer[ARGUMENT_BUFFER_SIZE];
+    Slice args;
+    if (exec_arguments(code, frame, buffer, &args)) {
+      result = nse_call(function, args);
+      release_arguments(args, buffer);
+    }
+    del_ref(function);
+  }
+  return result;
+}
+
+static NseVal exec_macro(Code *code, Frame *frame, TailCall *tail) {
+  NseVal macro_function = scope_get_macro(NULL, code->call.name);
+  if (RESULT_OK(macro_function)) {
+    return exec_macro_expansion(macro_function, code, frame, tail);
+  }
+  // Not a macro, so compile the arguments again to report the syntax error
+  return exec_in_scope(code->call.macro_args, code, frame, 1);
+}
+
+static NseVal exec_continue(Code *code, Frame *frame, TailCall *tail) {
+  if (tail && tail->loop) {
+    if (exec_arguments(code, frame, tail->buffer, &tail->args)) {
+      tail->pending = TAIL_CONTINUE;
+    }
+    return undefined;
+  }
+  NseVal result = undefined;
+  NseVal buffer[ARGUMENT_BUFFER_SIZE];
+  Slice args;
+  if (exec_arguments(code, frame, buffer, &args)) {
+    NseVal arg_list = slice_to_list(args);
     if (RESULT_OK(arg_list)) {
-      result = nse_apply(function, arg_list);
+      result = check_alloc(CONTINUE(create_continue(arg_list)));
       del_ref(arg_list);
     }
-    del_ref(function);
+    release_arguments(args, buffer);
   }
   return result;
 }
 
-NseVal eval(NseVal code, Scope *scope) {
-  switch (code.type->internal) {
-    case INTERNAL_CONS:
-      return eval_cons(code.cons, scope);
-    case INTERNAL_I64:
-    case INTERNAL_F64:
-    case INTERNAL_STRING:
-      return add_ref(code);
-    case INTERNAL_QUOTE:
-      if (code.type == type_quote_type) {
-        Scope *type_scope = use_module_types(scope->module);
-        NseVal result = eval(code.quote->quoted, type_scope);
-        scope_pop(type_scope);
-        return result;
-      }
-      return syntax_to_datum(code.quote->quoted);
-    case INTERNAL_SYMBOL:
-      if (code.type == keyword_type) {
-        return add_ref(code);
+/* Executes `(cons EXPR (SELF {EXPR}))` by appending the value of EXPR to the
+ * list of the loop and continuing the loop with the arguments of the
+ * self-call, so that the rest of the list is built without recursion. */
+static NseVal exec_tail_cons(Code *code, Frame *frame, TailCall *tail) {
+  NseVal function = *code->call.function->var.global;
+  if (!tail || !tail->loop || !RESULT_OK(function) || function.type->internal != INTERNAL_FUNC
+      || function.func != cons_ || RESULT_OK(find_macro(code->call.name))) {
+    return exec_call(code, frame, tail);
+  }
+  NseVal head = exec(code->call.args[0], frame);
+  if (!RESULT_OK(head)) {
+    return undefined;
+  }
+  NseVal cons = check_alloc(CONS(create_cons(head, nil)));
+  del_ref(head);
+  if (!RESULT_OK(cons)) {
+    return undefined;
+  }
+  if (tail->destination) {
+    *tail->destination = cons;
+  } else {
+    tail->list = cons;
+    // The rest of the list is the result of the loop, so it can't be left to
+    // `eval_anon()`
+    tail->calls = 0;
+  }
+  tail->destination = &cons.cons->tail;
+  return exec_continue(code->call.args[1], frame, tail);
+}
+
+static NseVal exec_recur(Code *code, Frame *frame) {
+  for (size_t i = 0; i < code->recur.init_size; i++) {
+    set_slot(frame, code->recur.init_slots[i], get_variable(code->recur.inits[i], frame));
+  }
+  TailCall tail;
+  tail.pending = TAIL_NONE;
+  tail.calls = 0;
+  tail.loop = 1;
+  return exec_loop_body(code->recur.body, &code->recur.parameters, frame, &tail);
+}
+
+static NseVal exec_variable(Code *code, Frame *frame) {
+  NseVal value = get_variable(code, frame);
+  if (!RESULT_OK(value)) {
+    raise_error(name_error, "undefined name: %s", code->var.symbol->name);
+    return undefined;
+  }
+  if (value.type->internal == INTERNAL_GFUNC && !value.gfunc->context) {
+    GFunc *bound = bind_gfunc(value.gfunc, frame->module);
+    if (!bound) {
+      return undefined;
+    }
+    return add_ref(GFUNC(bound));
+  }
+  return add_ref(value);
+}
+
+static NseVal exec_type_quote(Code *code, Frame *frame) {
+  Frame type_frame;
+  if (!init_frame(&type_frame, code->type_quote.frame_size, NULL, 0, frame->module)) {
+    return undefined;
+  }
+  NseVal result = exec(code->type_quote.body, &type_frame);
+  delete_frame(&type_frame);
+  return result;
+}
+
+/* Evaluates a special form that operates on syntax. The local variables that
+ * are visible to the form are pushed onto the scope that the code was
+ * compiled in. */
+static NseVal exec_special(Code *code, Frame *frame) {
+  LexScope *root = code->special.scope;
+  while (root->next) {
+    root = root->next;
+  }
+  Scope *scope = root->runtime;
+  for (size_t i = code->special.size; i > 0; i--) {
+    scope = scope_push(scope, code->special.names[i - 1], get_variable(code->special.vars[i - 1], frame));
+  }
+  Module *module = scope->module;
+  scope->module = frame->module;
+  NseVal result = code->special.f(code->special.args, scope);
+  scope->module = module;
+  scope_pop_until(scope, root->runtime);
+  return result;
+}
+
+/* Executes all but the last statement of a block, assigning let-statements to
+ * their slots. Returns 0 on error. */
+static int exec_statements(Code *code, Frame *frame) {
+  for (size_t i = 0; i + 1 < code->block.size; i++) {
+    NseVal value = exec(code->block.statements[i], frame);
+    if (!RESULT_OK(value)) {
+      return 0;
+    }
+    if (code->block.bind[i]) {
+      set_slot(frame, code->block.slots[i], value);
+    }
+    del_ref(value);
+  }
+  return 1;
+}
+
+/* Makes the form of `code` the current form when continuing execution of a
+ * node in tail position. */
+static void set_code_form(Code *code) {
+  if (code->form) {
+    current_form = code->form;
+  }
+}
+
+NseVal exec(Code *code, Frame *frame) {
+  return exec_code(code, frame, NULL);
+}
+
+/* Executes code. Code reached through the tail of `code` is in tail position
+ * of a lambda body if `tail` is not NULL. */
+static NseVal exec_code(Code *code, Frame *frame, TailCall *tail) {
+  NseVal result = undefined;
+  Syntax *previous = current_form;
+  set_code_form(code);
+  while (1) {
+    switch (code->type) {
+      case CODE_CONST:
+        result = add_ref(code->constant);
+        break;
+      case CODE_LOCAL:
+      case CODE_ENV:
+      case CODE_GLOBAL:
+      case CODE_BINDING:
+        result = exec_variable(code, frame);
+        break;
+      case CODE_TYPE_QUOTE:
+        result = exec_type_quote(code, frame);
+        break;
+      case CODE_IF: {
+        NseVal condition = exec(code->if_.condition, frame);
+        if (!RESULT_OK(condition)) {
+          break;
+        }
+        code = is_true(condition) ? code->if_.consequent : code->if_.alternative;
+        del_ref(condition);
+        set_code_form(code);
+        continue;
       }
-      NseVal value = scope_get(scope, code.symbol);
-      if (RESULT_OK(value) && value.type->internal == INTERNAL_GFUNC && !value.gfunc->context) {
-        return check_alloc(GFUNC(create_gfunc(value.gfunc->name, copy_type(value.gfunc->type), scope->module)));
+      case CODE_DO:
+        if (code->block.size == 0) {
+          result = nil;
+          break;
+        }
+        if (!exec_statements(code, frame)) {
+          break;
+        }
+        if (code->block.bind[code->block.size - 1]) {
+          result = exec(code->block.statements[code->block.size - 1], frame);
+          if (RESULT_OK(result)) {
+            del_ref(result);
+            result = nil;
+          }
+          break;
+        }
+        code = code->block.statements[code->block.size - 1];
+        set_code_form(code);
+        continue;
+      case CODE_LET:
+        if (!exec_let_bindings(code, frame)) {
+          break;
+        }
+        code = code->let.body;
+        set_code_form(code);
+        continue;
+      case CODE_MATCH: {
+        Code *body = exec_match_case(code, frame);
+        if (!body) {
+          break;
+        }
+        code = body;
+        set_code_form(code);
+        continue;
       }
-      return add_ref(value);
-    case INTERNAL_SYNTAX: {
-      Syntax *previous = push_debug_form(code.syntax);
-      return pop_debug_form(eval(code.syntax->quoted, scope), previous);
+      case CODE_FN:
+        result = exec_fn(code, frame);
+        break;
+      case CODE_TRY:
+        result = exec_try(code, frame);
+        break;
+      case CODE_CALL:
+        result = exec_call(code, frame, tail);
+        break;
+      case CODE_MACRO:
+        result = exec_macro(code, frame, tail);
+        break;
+      case CODE_CONTINUE:
+        result = exec_continue(code, frame, tail);
+        break;
+      case CODE_TAIL_CONS:
+        result = exec_tail_cons(code, frame, tail);
+        break;
+      case CODE_RECUR:
+        result = exec_recur(code, frame);
+        break;
+      case CODE_LOOP:
+        result = exec_loop(code, frame);
+        break;
+      case CODE_DEF_VAR:
+        result = exec_def_var(code, frame);
+        break;
+      case CODE_DEF_FUNC:
+        result = exec_def_func(code, frame);
+        break;
+      case CODE_DEF_MACRO:
+        result = exec_def_macro(code, frame);
+        break;
+      case CODE_DEF_READ_MACRO:
+        result = exec_def_read_macro(code, frame);
+        break;
+      case CODE_SPECIAL:
+        result = exec_special(code, frame);
+        break;
     }
-    default:
-      raise_error(domain_error, "unexpected value type: %s", ""); // TODO
-      return undefined;
+    break;
   }
+  current_form = previous;
+  return result;
+}
+
+NseVal eval(NseVal code, Scope *scope) {
+  Compiler c;
+  if (!init_compiler(&c, scope)) {
+    return undefined;
+  }
+  Code *compiled = compile(code, &c);
+  size_t frame_size = c.frame_size;
+  delete_compiler(&c);
+  if (!compiled) {
+    return undefined;
+  }
+  NseVal result = undefined;
+  Frame frame;
+  if (init_frame(&frame, frame_size, NULL, 0, scope->module)) {
+    result = exec(compiled, &frame);
+    delete_frame(&frame);
+  }
+  delete_code(compiled);
+  return result;
 }
 
 NseVal expand_macro_1(NseVal code, Scope *scope, int *expanded) {
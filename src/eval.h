@@ -3,20 +3,55 @@
 
 #include "runtime/value.h"
 #include "module.h"
+#include "compile.h"
+
+/* The activation record of a compiled function or top-level form. Local
+ * variables are stored in `slots`, variables of enclosing functions are
+ * stored in the closure environment `env`. */
+typedef struct Frame Frame;
+typedef struct FrameChunk FrameChunk;
+
+struct Frame {
+  NseVal *slots;
+  size_t size;
+  /* Chunk of the frame stack that the slots were allocated from, NULL if the
+   * slots were allocated on the heap. */
+  FrameChunk *chunk;
+  NseVal *env;
+  size_t env_size;
+  Module *module;
+};
 
 NseVal eval(NseVal code, Scope *scope);
-NseVal eval_block(NseVal block, Scope *scope);
-NseVal eval_anon(NseVal args, NseVal env[]);
-NseVal eval_anon_type(NseVal args, NseVal env[]);
-NseVal eval_list(NseVal list, Scope *scope);
+NseVal exec(Code *code, Frame *frame);
+NseVal eval_anon(Slice args, NseVal env[]);
 
-CType *parameters_to_type(NseVal formal);
-int assign_parameters(Scope **scope, NseVal formal, NseVal actual);
+/* Initializes a frame with `size` undefined slots allocated from the frame
+ * stack. Frames must be deleted in the reverse order of their creation.
+ * Returns 0 on error. */
+int init_frame(Frame *frame, size_t size, NseVal *env, size_t env_size, Module *module);
+void delete_frame(Frame *frame);
+/* Grows a frame to at least `size` slots. Returns 0 on error. */
+int grow_frame(Frame *frame, size_t size);
+void set_slot(Frame *frame, size_t slot, NseVal value);
+/* Returns a borrowed reference to the value of a variable, or undefined if
+ * the variable has not been assigned. Does not raise an error. */
+NseVal get_variable(Code *code, Frame *frame);
 
-int match_pattern(Scope **scope, NseVal pattern, NseVal actual);
+CType *parameters_to_type(NseVal formal);
+int assign_parameters(Parameters *parameters, Slice actual, Frame *frame);
+/* Assigns a list of arguments, e.g. the arguments of a continue-form. */
+int assign_parameter_list(Parameters *parameters, NseVal actual, Frame *frame);
 
-Closure *optimize_tail_call(Closure *closure, Symbol *name);
-NseVal optimize_tail_call_any(NseVal code, Symbol *name);
+int match_pattern(Pattern *pattern, NseVal actual, Frame *frame);
+/* Tests whether a value matches a pattern and assigns the variables of the
+ * pattern in the same pass. Raises no error, a failed match may leave some of
+ * the variables assigned. */
+int try_match_pattern(Pattern *pattern, NseVal actual, Frame *frame);
+/* Like `try_match_pattern()` for the fields of data whose constructor tag is
+ * already known to match. `fields` is the pattern list following the tag, or
+ * NULL for a quoted constructor without parameters. */
+int try_match_fields(Pattern *fields, Data *data, Frame *frame);
 
 NseVal expand_macro_1(NseVal code, Scope *scope, int *expanded);
 NseVal expand_macro(NseVal code, Scope *scope);
@@ -84,6 +84,23 @@ void init_lang_module() {
   rest_keyword = module_extern_symbol(lang_module, "&rest");
   match_keyword = module_extern_symbol(lang_module, "&match");
 
+  if_symbol->special = SPECIAL_IF;
+  let_symbol->special = SPECIAL_LET;
+  match_symbol->special = SPECIAL_MATCH;
+  do_symbol->special = SPECIAL_DO;
+  fn_symbol->special = SPECIAL_FN;
+  try_symbol->special = SPECIAL_TRY;
+  continue_symbol->special = SPECIAL_CONTINUE;
+  recur_symbol->special = SPECIAL_RECUR;
+  def_symbol->special = SPECIAL_DEF;
+  def_read_macro_symbol->special = SPECIAL_DEF_READ_MACRO;
+  def_type_symbol->special = SPECIAL_DEF_TYPE;
+  def_data_symbol->special = SPECIAL_DEF_DATA;
+  def_macro_symbol->special = SPECIAL_DEF_MACRO;
+  def_generic_symbol->special = SPECIAL_DEF_GENERIC;
+  def_method_symbol->special = SPECIAL_DEF_METHOD;
+  loop_symbol->special = SPECIAL_LOOP;
+
   true_value = DATA(create_data(copy_type(bool_type), true_symbol, NULL, 0));
   module_define(true_symbol, true_value);
   false_value = DATA(create_data(copy_type(bool_type), false_symbol, NULL, 0));
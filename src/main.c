@@ -8,6 +8,7 @@
 
 #include "runtime/value.h"
 #include "runtime/error.h"
+#include "runtime/cycle.h"
 #include "read.h"
 #include "write.h"
 #include "eval.h"
@@ -30,7 +31,7 @@ void describe_option(const char *short_option, const char *long_option, const ch
   printf("  -%-14s --%-18s %s\n", short_option, long_option, description);
 }
 
-NseVal load(NseVal args) {
+NseVal load(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   const char *name = to_string_constant(arg);
@@ -52,6 +53,7 @@ NseVal load(NseVal args) {
             return_value = undefined;
             break;
           }
+          collect_cycles_if_needed();
         } else {
           // TODO: check type of error
           clear_error();
@@ -70,7 +72,7 @@ NseVal load(NseVal args) {
   return undefined;
 }
 
-NseVal read_(NseVal args) {
+NseVal read_(Slice args) {
   ARG_POP_TYPE(String *, string, args, to_string, "a string");
   ARG_DONE(args);
   Stream *input = stream_buffer(string->chars, string->length, string->length);
@@ -80,7 +82,7 @@ NseVal read_(NseVal args) {
   return return_value;
 }
 
-NseVal write_(NseVal args) {
+NseVal write_(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   char *buffer = malloc(50);
@@ -99,13 +101,13 @@ NseVal write_(NseVal args) {
   return result;
 }
 
-NseVal eval_(NseVal args) {
+NseVal eval_(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   return eval(arg, current_scope);
 }
 
-NseVal def_module(NseVal args) {
+NseVal def_module(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   const char *name = to_string_constant(arg);
@@ -129,7 +131,7 @@ NseVal def_module(NseVal args) {
   return undefined;
 }
 
-NseVal in_module(NseVal args) {
+NseVal in_module(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   const char *name = to_string_constant(arg);
@@ -147,12 +149,13 @@ NseVal in_module(NseVal args) {
   return undefined;
 }
 
-NseVal export(NseVal args) {
-  do {
-    NseVal h = head(args);
-    if (!RESULT_OK(h)) {
-      return h;
-    }
+NseVal export(Slice args) {
+  if (args.length == 0) {
+    raise_error(domain_error, "too few parameters for function");
+    return undefined;
+  }
+  for (size_t i = 0; i < args.length; i++) {
+    NseVal h = args.cells[i];
     const char *name = to_string_constant(h);
     if (name) {
       NseVal result = check_alloc(SYMBOL(module_extern_symbol(current_scope->module, name)));
@@ -163,12 +166,11 @@ NseVal export(NseVal args) {
       raise_error(domain_error, "must be called with one or more symbols");
       return undefined;
     }
-    args = tail(args);
-  } while (is_cons(args));
+  }
   return nil;
 }
 
-NseVal import(NseVal args) {
+NseVal import(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   const char *name = to_string_constant(arg);
@@ -186,20 +188,20 @@ NseVal import(NseVal args) {
   return undefined;
 }
 
-NseVal intern(NseVal args) {
+NseVal intern(Slice args) {
   ARG_POP_TYPE(Symbol *, symbol, args, to_symbol, "a symbol");
   ARG_DONE(args);
   import_module_symbol(current_scope->module, symbol);
   return nil;
 }
 
-NseVal describe(NseVal args) {
+NseVal describe(Slice args) {
   Stream *out = stdout_stream;
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   nse_write(arg, out, NULL);
   stream_printf(out, "\n");
-  nse_write(TYPE(arg.type), out, current_scope->module);
+  nse_write(TYPE(get_type(arg)), out, current_scope->module);
   stream_printf(out, "\n");
   if (arg.type->internal == INTERNAL_CLOSURE) {
     stream_printf(out, "\n");
@@ -228,7 +230,7 @@ NseVal describe(NseVal args) {
         stream_printf(out, " names a value:\n", s->name);
         nse_write(value, out, NULL);
         stream_printf(out, "\n");
-        nse_write(TYPE(value.type), out, current_scope->module);
+        nse_write(TYPE(get_type(value)), out, current_scope->module);
         stream_printf(out, "\n");
       }
     } else {
@@ -253,7 +255,7 @@ NseVal describe(NseVal args) {
         stream_printf(out, " names a macro:\n", s->name);
         nse_write(value, out, NULL);
         stream_printf(out, "\n");
-        nse_write(TYPE(value.type), out, current_scope->module);
+        nse_write(TYPE(get_type(value)), out, current_scope->module);
         stream_printf(out, "\n");
       }
     } else {
@@ -280,7 +282,7 @@ NseVal describe(NseVal args) {
         stream_printf(out, " names a type:\n", s->name);
         nse_write(value, out, NULL);
         stream_printf(out, "\n");
-        nse_write(TYPE(value.type), out, current_scope->module);
+        nse_write(TYPE(get_type(value)), out, current_scope->module);
         stream_printf(out, "\n");
       }
     } else {
@@ -506,9 +508,9 @@ int main(int argc, char *argv[]) {
   rl_attempted_completion_function = symbol_completion;
 
   if (std) {
-    NseVal args = CONS(create_cons(SYMBOL(intern_keyword("std.lisp")), nil));
-    del_ref(load(args));
-    del_ref(args);
+    NseVal arg = SYMBOL(intern_keyword("std.lisp"));
+    del_ref(load(SLICE(&arg, 1)));
+    del_ref(arg);
   }
   if (std) {
     import_module(user_module, system_module);
@@ -588,6 +590,9 @@ int main(int argc, char *argv[]) {
     close_reader(reader);
     free(input);
     printf("\n");
+    // Finish deleting large values while waiting for input
+    flush_deleted();
+    collect_cycles_if_needed();
   }
   if (line_history) {
     free(line_history);
@@ -3,16 +3,22 @@
 #include "runtime/value.h"
 #include "runtime/error.h"
 #include "runtime/hashmap.h"
+#include "runtime/pool.h"
 
 #include "util/stream.h"
 
 typedef struct Method Method;
+typedef struct MethodList MethodList;
 
 DECLARE_HASH_MAP(namespace, Namespace, Symbol *, NseVal *)
 DECLARE_HASH_MAP(symmap, SymMap, char *, Symbol *)
 DECLARE_HASH_MAP(module_map, ModuleMap, char *, Module *)
 
 DECLARE_HASH_MAP(method_map, MethodMap, Method *, NseVal *)
+DECLARE_HASH_MAP(generic_map, GenericMap, Symbol *, MethodList *)
+
+/* Maximum number of entries in the dispatch table of a module. */
+#define DISPATCH_TABLE_LIMIT 1024
 
 struct module {
   char *name;
@@ -23,11 +29,31 @@ struct module {
   Namespace type_defs;
   Namespace read_macro_defs;
   MethodMap methods;
+  /* The entries of `methods` grouped by generic function. */
+  GenericMap generics;
+  /* Methods selected for the argument types of previous applications, see
+   * `module_find_method()`. Cleared whenever a method is added or replaced,
+   * and when it reaches DISPATCH_TABLE_LIMIT entries. */
+  MethodMap dispatch;
+  /* Incremented whenever the dispatch table is cleared. */
+  unsigned int method_version;
 };
 
 struct Method {
   Symbol *symbol;
   CTypeArray *parameters;
+  /* Position of the method in the order that methods are defined in. Imported
+   * methods keep the position of the original definition. */
+  size_t sequence;
+};
+
+/* The methods of a generic function. The keys and value boxes are owned by the
+ * method map of the module. */
+struct MethodList {
+  size_t size;
+  size_t capacity;
+  Method **keys;
+  NseVal **values;
 };
 
 struct binding {
@@ -36,8 +62,13 @@ struct binding {
   NseVal value;
 };
 
+_Static_assert(sizeof(Binding) <= POOL_MAX_SIZE, "Binding must fit in a pool");
+_Static_assert(sizeof(Scope) <= POOL_MAX_SIZE, "Scope must fit in a pool");
+
 static ModuleMap loaded_modules = NULL_HASH_MAP;
 
+static size_t next_method_sequence = 0;
+
 Module *keyword_module = NULL;
 
 static void init_modules() {
@@ -47,7 +78,7 @@ static void init_modules() {
 }
 
 Binding *create_binding(NseVal value) {
-  Binding *binding = malloc(sizeof(Binding));
+  Binding *binding = pool_allocate(sizeof(Binding));
   binding->refs = 1;
   binding->value = add_ref(value);
   binding->weak = 0;
@@ -69,6 +100,10 @@ void set_binding(Binding *binding, NseVal value, int weak) {
   del_ref(old);
 }
 
+NseVal binding_value(Binding *binding) {
+  return binding->value;
+}
+
 void delete_binding(Binding *binding) {
   if (binding->refs > 1) {
     binding->refs--;
@@ -76,12 +111,12 @@ void delete_binding(Binding *binding) {
     if (!binding->weak) {
       del_ref(binding->value);
     }
-    free(binding);
+    pool_free(binding, sizeof(Binding));
   }
 }
 
 Scope *scope_push(Scope *next, Symbol *symbol, NseVal value) {
-  Scope *scope = malloc(sizeof(Scope));
+  Scope *scope = pool_allocate(sizeof(Scope));
   if (symbol) {
     add_ref(SYMBOL(symbol));
   }
@@ -101,7 +136,7 @@ Scope *scope_pop(Scope *scope) {
     del_ref(SYMBOL(scope->symbol));
   }
   delete_binding(scope->binding);
-  free(scope);
+  pool_free(scope, sizeof(Scope));
   return next;
 }
 
@@ -112,7 +147,7 @@ void scope_pop_until(Scope *start, Scope *end) {
       del_ref(SYMBOL(start->symbol));
     }
     delete_binding(start->binding);
-    free(start);
+    pool_free(start, sizeof(Scope));
     start = next;
   }
 }
@@ -121,7 +156,7 @@ Scope *copy_scope(Scope *scope) {
   if (scope == NULL) {
     return NULL;
   }
-  Scope *copy = malloc(sizeof(Scope));
+  Scope *copy = pool_allocate(sizeof(Scope));
   if (scope->symbol) {
     add_ref(SYMBOL(scope->symbol));
   }
@@ -140,7 +175,7 @@ void delete_scope(Scope *scope) {
       del_ref(SYMBOL(scope->symbol));
     }
     delete_binding(scope->binding);
-    free(scope);
+    pool_free(scope, sizeof(Scope));
   }
 }
 
@@ -179,7 +214,7 @@ NseVal scope_get(Scope *scope, Symbol *symbol) {
         value = namespace_lookup(symbol->module->type_defs, symbol);
         break;
     }
-    if (value) {
+    if (value && RESULT_OK(*value)) {
       return *value;
     }
   }
@@ -187,21 +222,28 @@ NseVal scope_get(Scope *scope, Symbol *symbol) {
   return undefined;
 }
 
-NseVal scope_get_macro(Scope *scope, Symbol *symbol) {
-  if (symbol->module) {
+NseVal find_macro(Symbol *symbol) {
+  if (symbol->macro && symbol->module) {
     NseVal *value = namespace_lookup(symbol->module->macro_defs, symbol);
-    if (value) {
+    if (value && RESULT_OK(*value)) {
       return *value;
     }
   }
-  raise_error(name_error, "undefined macro");
   return undefined;
 }
 
+NseVal scope_get_macro(Scope *scope, Symbol *symbol) {
+  NseVal value = find_macro(symbol);
+  if (!RESULT_OK(value)) {
+    raise_error(name_error, "undefined macro");
+  }
+  return value;
+}
+
 NseVal get_read_macro(Symbol *symbol) {
   if (symbol->module) {
     NseVal *value = namespace_lookup(symbol->module->read_macro_defs, symbol);
-    if (value) {
+    if (value && RESULT_OK(*value)) {
       return *value;
     }
   }
@@ -229,6 +271,9 @@ Module *create_module(const char *name) {
   module->type_defs = create_namespace();
   module->read_macro_defs = create_namespace();
   module->methods = create_method_map();
+  module->generics = create_generic_map();
+  module->dispatch = create_method_map();
+  module->method_version = 0;
   module_map_add(loaded_modules, module->name, module);
   return module;
 }
@@ -239,6 +284,17 @@ static void delete_method(Method *method) {
   free(method);
 }
 
+static void delete_generics(GenericMap generics) {
+  GenericMapIterator it = create_generic_map_iterator(generics);
+  for (GenericMapEntry entry = generic_map_next(it); entry.key; entry = generic_map_next(it)) {
+    free(entry.value->keys);
+    free(entry.value->values);
+    free(entry.value);
+  }
+  delete_generic_map_iterator(it);
+  delete_generic_map(generics);
+}
+
 static void delete_methods(MethodMap methods) {
   MethodMapIterator it = create_method_map_iterator(methods);
   for (MethodMapEntry entry = method_map_next(it); entry.key; entry = method_map_next(it)) {
@@ -250,11 +306,20 @@ static void delete_methods(MethodMap methods) {
   delete_method_map(methods);
 }
 
-static void delete_symbols(SymMap symbols) {
+/* Symbols interned in the module are immortal and may still be referenced by
+ * quoted data, data tags or generic functions elsewhere, so they are detached
+ * from the module instead of freed. Symbols imported from elsewhere are only
+ * released. */
+static void delete_symbols(SymMap symbols, Module *module) {
   SymMapIterator it = create_symmap_iterator(symbols);
   for (SymMapEntry entry = symmap_next(it); entry.key; entry = symmap_next(it)) {
-    if (entry.value) {
+    if (!entry.value) {
+      continue;
+    }
+    if (entry.value->module != module) {
       del_ref(SYMBOL(entry.value));
+    } else {
+      entry.value->module = NULL;
     }
   }
   delete_symmap_iterator(it);
@@ -280,9 +345,11 @@ void delete_module(Module *module) {
   delete_defs(module->macro_defs);
   delete_defs(module->type_defs);
   delete_defs(module->read_macro_defs);
-  delete_symbols(module->internal);
-  delete_symbols(module->external);
+  delete_generics(module->generics);
   delete_methods(module->methods);
+  delete_methods(module->dispatch);
+  delete_symmap(module->external);
+  delete_symbols(module->internal, module);
   free(module->name);
   free(module);
 }
@@ -304,13 +371,128 @@ Scope *use_module_types(Module *module) {
   return scope;
 }
 
+/* Compares the parameter types of two applicable methods by their distances
+ * from the argument types. Parameters are compared from left to right, so the
+ * first parameter that differs decides which method is more specific. Methods
+ * that are equally specific are ordered by definition, so the method defined
+ * first is selected. */
+static int compare_methods(const CTypeArray *arguments, const Method *a, const Method *b) {
+  for (size_t i = 0; i < arguments->size; i++) {
+    int distance_a = subtype_distance(arguments->elements[i], a->parameters->elements[i]);
+    int distance_b = subtype_distance(arguments->elements[i], b->parameters->elements[i]);
+    if (distance_a != distance_b) {
+      return distance_a - distance_b;
+    }
+  }
+  return a->sequence < b->sequence ? -1 : a->sequence > b->sequence;
+}
+
+/* Forgets the methods selected by previous applications, e.g. after the
+ * methods of the module have changed. The dispatch caches of generic functions
+ * borrow the types of the table, so they are invalidated as well. */
+static void invalidate_dispatch(Module *module) {
+  delete_methods(module->dispatch);
+  module->dispatch = create_method_map();
+  module->method_version++;
+}
+
+/* Adds a method to the list of methods of its generic function. Returns 0 if
+ * allocation fails. */
+static int add_generic_method(Module *module, Method *key, NseVal *value) {
+  MethodList *list = generic_map_lookup(module->generics, key->symbol);
+  if (!list) {
+    list = allocate(sizeof(MethodList));
+    if (!list) {
+      return 0;
+    }
+    *list = (MethodList){ .size = 0, .capacity = 0, .keys = NULL, .values = NULL };
+    generic_map_add(module->generics, key->symbol, list);
+  }
+  if (list->size >= list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 4;
+    Method **keys = realloc(list->keys, sizeof(Method *) * capacity);
+    if (!keys) {
+      raise_error(out_of_memory_error, "out of memory");
+      return 0;
+    }
+    list->keys = keys;
+    NseVal **values = realloc(list->values, sizeof(NseVal *) * capacity);
+    if (!values) {
+      raise_error(out_of_memory_error, "out of memory");
+      return 0;
+    }
+    list->values = values;
+    list->capacity = capacity;
+  }
+  list->keys[list->size] = key;
+  list->values[list->size] = value;
+  list->size++;
+  return 1;
+}
+
+/* Finds the most specific method that accepts arguments of the given types. */
+static NseVal resolve_method(Module *module, Symbol *symbol, const CTypeArray *arguments) {
+  MethodList *list = generic_map_lookup(module->generics, symbol);
+  if (!list) {
+    return undefined;
+  }
+  Method *best = NULL;
+  NseVal method = undefined;
+  for (size_t j = 0; j < list->size; j++) {
+    Method *m = list->keys[j];
+    if (m->parameters->size != arguments->size) {
+      continue;
+    }
+    size_t i = 0;
+    while (i < arguments->size && is_subtype_of(arguments->elements[i], m->parameters->elements[i])) {
+      i++;
+    }
+    if (i < arguments->size) {
+      continue;
+    }
+    if (!best || compare_methods(arguments, m, best) < 0) {
+      best = m;
+      method = *list->values[j];
+    }
+  }
+  return method;
+}
+
 NseVal module_find_method(Module *module, Symbol *symbol, const CTypeArray *parameters) {
-  Method query = (Method){ .symbol = symbol, .parameters = (CTypeArray *)parameters };
-  NseVal *method = method_map_lookup(module->methods, &query);
+  Method query = (Method){ .symbol = symbol, .parameters = (CTypeArray *)parameters, .sequence = 0 };
+  NseVal *method = method_map_lookup(module->dispatch, &query);
   if (method) {
     return *method;
   }
-  return undefined;
+  NseVal result = resolve_method(module, symbol, parameters);
+  if (!RESULT_OK(result)) {
+    return undefined;
+  }
+  if (get_hash_map_size(module->dispatch.map) >= DISPATCH_TABLE_LIMIT) {
+    invalidate_dispatch(module);
+  }
+  CTypeArray *key_parameters = create_type_array_null(parameters->size);
+  Method *key = allocate(sizeof(Method));
+  NseVal *box = allocate(sizeof(NseVal));
+  if (!key_parameters || !key || !box) {
+    delete_type_array(key_parameters);
+    free(key);
+    free(box);
+    return result;
+  }
+  for (size_t i = 0; i < parameters->size; i++) {
+    key_parameters->elements[i] = copy_type(parameters->elements[i]);
+  }
+  key->symbol = add_ref(SYMBOL(symbol)).symbol;
+  key->parameters = key_parameters;
+  key->sequence = 0;
+  *box = add_ref(result);
+  method_map_add(module->dispatch, key, box);
+  return result;
+}
+
+unsigned int module_method_version(Module *module) {
+  return module->method_version;
 }
 
 Module *find_module(const char *name) {
@@ -357,7 +539,6 @@ Symbol *find_symbol(const char *s) {
     if (module) {
       Symbol *value = symmap_lookup(module->external, s);
       if (value) {
-        value->refs++;
         free(module_name);
         return value;
       } else {
@@ -374,15 +555,13 @@ Symbol *find_symbol(const char *s) {
 Symbol *module_extern_symbol(Module *module, const char *s) {
   Symbol *value = symmap_lookup(module->external, s);
   if (value) {
-    value->refs++;
     return value;
   }
   value = module_intern_symbol(module, s);
-  if (!s) {
+  if (!value) {
     return NULL;
   }
   symmap_add(module->external, value->name, value);
-  value->refs++;
   return value;
 }
 
@@ -401,24 +580,19 @@ Symbol *intern_special(const char *s) {
 }
 
 Symbol *module_find_internal(Module *module, const char *s) {
-  Symbol *value = symmap_lookup(module->internal, s);
-  if (value) {
-    value->refs++;
-    return value;
-  }
-  return NULL;
+  return symmap_lookup(module->internal, s);
 }
 
 Symbol *module_intern_symbol(Module *module, const char *s) {
   Symbol *value = symmap_lookup(module->internal, s);
   if (!value) {
     value = create_symbol(s, module);
-    if (!s) {
+    if (!value) {
       return NULL;
     }
+    value->header.refs = IMMORTAL_REFS;
     symmap_add(module->internal, value->name, value);
   }
-  value->refs++;
   return value;
 }
 
@@ -447,12 +621,15 @@ char **get_symbols(Module *module) {
   return symbols;
 }
 
-int import_method(Module *dest, Symbol *symbol, CTypeArray *parameters, NseVal value) {
+static int import_method(Module *dest, Method *method, NseVal value) {
+  Symbol *symbol = method->symbol;
+  CTypeArray *parameters = method->parameters;
   Method *m = allocate(sizeof(Method));
   if (!m) {
     return 0;
   }
   m->symbol = symbol;
+  m->sequence = method->sequence;
   NseVal *value_box = allocate(sizeof(NseVal));
   if (!value_box) {
     free(m);
@@ -464,6 +641,10 @@ int import_method(Module *dest, Symbol *symbol, CTypeArray *parameters, NseVal v
     add_ref(SYMBOL(symbol));
     copy_type_array(parameters);
     add_ref(value);
+    invalidate_dispatch(dest);
+    if (!add_generic_method(dest, m, value_box)) {
+      return 0;
+    }
   } else {
     free(value_box);
     free(m);
@@ -474,7 +655,7 @@ int import_method(Module *dest, Symbol *symbol, CTypeArray *parameters, NseVal v
 int import_methods(Module *dest, Module *src) {
   MethodMapIterator it = create_method_map_iterator(src->methods);
   for (MethodMapEntry entry = method_map_next(it); entry.key; entry = method_map_next(it)) {
-    if (!import_method(dest, entry.key->symbol, entry.key->parameters, *entry.value)) {
+    if (!import_method(dest, entry.key, *entry.value)) {
       delete_method_map_iterator(it);
       return 0;
     }
@@ -496,83 +677,87 @@ void import_module(Module *dest, Module *src) {
 }
 
 void import_module_symbol(Module *dest, Symbol *symbol) {
-  symmap_add(dest->internal, symbol->name, symbol);
+  if (symmap_add(dest->internal, symbol->name, symbol)) {
+    add_ref(SYMBOL(symbol));
+  }
 }
 
-void module_define(Symbol *s, NseVal value) {
-  NseVal *existing = namespace_remove(s->module->defs, s);
-  if (existing) {
-    del_ref(*existing);
-    free(existing);
-  } else {
+/* Definitions are updated in place, so that the box of a definition can be
+ * referenced directly by compiled code (see `module_binding()`). */
+static NseVal *define(Namespace namespace, Symbol *s) {
+  NseVal *box = namespace_lookup(namespace, s);
+  if (!box) {
+    box = allocate(sizeof(NseVal));
+    if (!box) {
+      return NULL;
+    }
+    *box = undefined;
+    namespace_add(namespace, s, box);
     add_ref(SYMBOL(s));
   }
-  NseVal *copy = malloc(sizeof(NseVal));
-  memcpy(copy, &value, sizeof(NseVal));
-  namespace_add(s->module->defs, s, copy);
-  add_ref(value);
+  return box;
 }
 
-void module_define_macro(Symbol *s, NseVal value) {
-  NseVal *existing = namespace_remove(s->module->macro_defs, s);
-  if (existing) {
-    del_ref(*existing);
-    free(existing);
-  } else {
-    add_ref(SYMBOL(s));
+static void set_definition(Namespace namespace, Symbol *s, NseVal value) {
+  NseVal *box = define(namespace, s);
+  if (box) {
+    NseVal existing = *box;
+    *box = add_ref(value);
+    del_ref(existing);
   }
-  NseVal *copy = malloc(sizeof(NseVal));
-  memcpy(copy, &value, sizeof(NseVal));
-  namespace_add(s->module->macro_defs, s, copy);
-  add_ref(value);
 }
 
-void module_define_type(Symbol *s, NseVal value) {
-  NseVal *existing = namespace_remove(s->module->type_defs, s);
-  if (existing) {
-    del_ref(*existing);
-    free(existing);
-  } else {
-    add_ref(SYMBOL(s));
+NseVal *module_binding(Symbol *s, ScopeType type) {
+  if (!s->module) {
+    return NULL;
+  }
+  switch (type) {
+    case TYPE_SCOPE:
+      return define(s->module->type_defs, s);
+    case VALUE_SCOPE:
+    default:
+      return define(s->module->defs, s);
   }
-  NseVal *copy = malloc(sizeof(NseVal));
-  memcpy(copy, &value, sizeof(NseVal));
-  namespace_add(s->module->type_defs, s, copy);
-  add_ref(value);
+}
+
+void module_define(Symbol *s, NseVal value) {
+  set_definition(s->module->defs, s, value);
+}
+
+void module_define_macro(Symbol *s, NseVal value) {
+  set_definition(s->module->macro_defs, s, value);
+  s->macro++;
+}
+
+void module_define_type(Symbol *s, NseVal value) {
+  set_definition(s->module->type_defs, s, value);
 }
 
 void module_define_read_macro(Symbol *s, NseVal value) {
-  NseVal *existing = namespace_remove(s->module->read_macro_defs, s);
-  if (existing) {
-    del_ref(*existing);
-    free(existing);
-  } else {
-    add_ref(SYMBOL(s));
-  }
-  NseVal *copy = malloc(sizeof(NseVal));
-  memcpy(copy, &value, sizeof(NseVal));
-  namespace_add(s->module->read_macro_defs, s, copy);
-  add_ref(value);
+  set_definition(s->module->read_macro_defs, s, value);
 }
 
 void module_define_method(Module *module, Symbol *symbol, CTypeArray *parameters, NseVal value) {
-  Method query = (Method){ .symbol = symbol, .parameters = parameters };
-  Method *key = NULL;
-  MethodMapEntry existing = method_map_remove_entry(module->methods, &query);
-  if (existing.key) {
-    key = existing.key;
-    del_ref(*existing.value);
-    free(existing.value);
+  Method query = (Method){ .symbol = symbol, .parameters = parameters, .sequence = next_method_sequence };
+  NseVal *box = method_map_lookup(module->methods, &query);
+  if (box) {
+    // The key and box stay in place, since the method list of the generic
+    // function refers to them
+    NseVal old = *box;
+    *box = add_ref(value);
+    del_ref(old);
     delete_type_array(parameters);
   } else {
-    key = malloc(sizeof(Method));
+    Method *key = malloc(sizeof(Method));
     *key = query;
+    next_method_sequence++;
     add_ref(SYMBOL(symbol));
+    box = malloc(sizeof(NseVal));
+    *box = add_ref(value);
+    method_map_add(module->methods, key, box);
+    add_generic_method(module, key, box);
   }
-  NseVal *copy = malloc(sizeof(NseVal));
-  memcpy(copy, &value, sizeof(NseVal));
-  method_map_add(module->methods, key, copy);
-  add_ref(value);
+  invalidate_dispatch(module);
 }
 
 Symbol *module_ext_define(Module *module, const char *name, NseVal value) {
@@ -603,7 +788,7 @@ static size_t method_hash(const Method *m) {
     CType *t = m->parameters->elements[i];
     hash = HASH_ADD_PTR(t, hash);
   }
-  return 0;
+  return hash;
 }
 
 static size_t method_equals(const Method *a, const Method *b) {
@@ -625,3 +810,4 @@ DEFINE_HASH_MAP(namespace, Namespace, Symbol *, NseVal *, pointer_hash, pointer_
 DEFINE_HASH_MAP(symmap, SymMap, char *, Symbol *, string_hash, string_equals)
 DEFINE_HASH_MAP(module_map, ModuleMap, char *, Module *, string_hash, string_equals)
 DEFINE_HASH_MAP(method_map, MethodMap, Method *, NseVal *, method_hash, method_equals)
+DEFINE_HASH_MAP(generic_map, GenericMap, Symbol *, MethodList *, pointer_hash, pointer_equals)
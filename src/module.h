@@ -23,6 +23,10 @@ struct scope {
 extern Module *lang_module;
 extern Module *keyword_module;
 
+Binding *copy_binding(Binding *binding);
+NseVal binding_value(Binding *binding);
+void delete_binding(Binding *binding);
+
 Scope *scope_push(Scope *scope, Symbol *symbol, NseVal value);
 Scope *scope_pop(Scope *scope);
 void scope_pop_until(Scope *start, Scope *end);
@@ -31,6 +35,9 @@ void delete_scope(Scope *scope);
 int scope_set(Scope *scope, Symbol *symbol, NseVal value, int weak);
 NseVal scope_get(Scope *scope, Symbol *symbol);
 NseVal scope_get_macro(Scope *scope, Symbol *symbol);
+/* Returns the macro named by `symbol` (borrowed), or undefined if the symbol
+ * does not name a macro. Does not raise an error. */
+NseVal find_macro(Symbol *symbol);
 NseVal get_read_macro(Symbol *symbol);
 
 Module *create_module(const char *name);
@@ -38,6 +45,11 @@ void delete_module(Module *module);
 const char *module_name(Module *module);
 Scope *use_module(Module *module);
 Scope *use_module_types(Module *module);
+/* Returns the box holding the definition of `s` in the value or type
+ * namespace of its module. The box is created (holding undefined) if the
+ * symbol has not been defined yet, and remains valid until the module is
+ * deleted. Returns NULL if the symbol does not belong to a module. */
+NseVal *module_binding(Symbol *s, ScopeType type);
 void module_define(Symbol *s, NseVal value);
 void module_define_macro(Symbol *s, NseVal value);
 void module_define_type(Symbol *s, NseVal value);
@@ -47,11 +59,19 @@ Symbol *module_ext_define(Module *module, const char *name, NseVal value);
 Symbol *module_ext_define_macro(Module *module, const char *name, NseVal value);
 Symbol *module_ext_define_type(Module *module, const char *name, NseVal value);
 
+/* Finds the most specific method of `symbol` whose parameter types are
+ * supertypes of `parameters`. Returns undefined if no method is applicable. The
+ * result remains valid until the method version of the module changes. */
 NseVal module_find_method(Module *module, Symbol *symbol, const CTypeArray *parameters);
+/* Returns a counter that changes whenever a method is defined in or imported
+ * into the module. */
+unsigned int module_method_version(Module *module);
 
 Module *find_module(const char *s);
 Symbol *find_symbol(const char *s);
 Symbol *module_find_internal(Module *module, const char *s);
+/* Returns the symbol with the given name in the module, creating it if it
+ * doesn't exist. Interned symbols are immortal (see `IMMORTAL_REFS`). */
 Symbol *module_intern_symbol(Module *module, const char *s);
 NseVal list_external_symbols(Module *module);
 char **get_symbols(Module *module);
@@ -59,6 +79,8 @@ Symbol *module_extern_symbol(Module *module, const char *s);
 Symbol *intern_keyword(const char *s);
 Symbol *intern_special(const char *s);
 void import_module(Module *dest, Module *src);
+/* Adds a symbol to the symbol table of a module, which takes a reference to
+ * it. Only symbols interned in their own module are immortal. */
 void import_module_symbol(Module *dest, Symbol *symbol);
 
 #endif
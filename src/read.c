@@ -5,6 +5,7 @@
 
 #include "runtime/value.h"
 #include "runtime/error.h"
+#include "runtime/pool.h"
 #include "read.h"
 
 #define MAX_LOOKAHEAD 2
@@ -116,7 +117,7 @@ static void delete_syntax(Syntax *syntax) {
   if (syntax->file) {
     del_ref(STRING(syntax->file));
   }
-  free(syntax);
+  pool_free(syntax, sizeof(Syntax));
 }
 
 static Syntax *start_pos(Syntax *syntax, Reader *input) {
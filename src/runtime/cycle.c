@@ -0,0 +1,280 @@
+#include <stdlib.h>
+
+#include "hashmap.h"
+#include "error.h"
+#include "type.h"
+
+#include "cycle.h"
+
+DECLARE_HASH_MAP(node_map, NodeMap, void *, size_t)
+
+/* Minimum number of boxes created between automatic collections. */
+#define COLLECT_THRESHOLD 1024
+
+typedef enum {
+  /* Visited, not known to be referenced from outside the visited values. */
+  NODE_GRAY,
+  /* Referenced from outside the visited values, directly or indirectly. */
+  NODE_BLACK,
+} NodeColor;
+
+/* A value visited by `collect_cycles()`. */
+typedef struct {
+  NseVal value;
+  /* Reference count minus the references from visited values. */
+  size_t count;
+  NodeColor color;
+} Node;
+
+/* State of a collection. */
+typedef struct {
+  /* Maps object pointers to indices in `nodes` plus one. */
+  NodeMap map;
+  Node *nodes;
+  size_t size;
+  size_t capacity;
+  /* Indices of nodes left to traverse. */
+  size_t *stack;
+  size_t stack_size;
+} Collector;
+
+/* Registered boxes. */
+static Box *boxes = NULL;
+static size_t box_count = 0;
+/* Number of boxes created since the last collection. */
+static size_t boxes_created = 0;
+static size_t collect_threshold = COLLECT_THRESHOLD;
+
+static void delete_box(Box *box) {
+  if (box->previous) {
+    box->previous->next = box->next;
+  } else {
+    boxes = box->next;
+  }
+  if (box->next) {
+    box->next->previous = box->previous;
+  }
+  box_count--;
+  del_ref(box->value);
+  free(box);
+}
+
+NseVal create_box() {
+  Box *box = allocate(sizeof(Box));
+  if (!box) {
+    return undefined;
+  }
+  NseVal reference = check_alloc(REFERENCE(create_reference(copy_type(box_type), box, (Destructor) delete_box)));
+  if (!RESULT_OK(reference)) {
+    free(box);
+    return undefined;
+  }
+  box->value = undefined;
+  box->reference = reference.reference;
+  box->previous = NULL;
+  box->next = boxes;
+  if (boxes) {
+    boxes->previous = box;
+  }
+  boxes = box;
+  box_count++;
+  boxes_created++;
+  return reference;
+}
+
+void set_box(NseVal box, NseVal value) {
+  Box *b = box.reference->pointer;
+  NseVal old = b->value;
+  b->value = add_ref(value);
+  del_ref(old);
+}
+
+/* Returns the header of a value that may be part of a cycle, or NULL if the
+ * value can't refer to other such values. */
+static Object *get_object(NseVal value) {
+  switch (value.type->internal) {
+    case INTERNAL_CONS:
+    case INTERNAL_LIST_BUILDER:
+    case INTERNAL_CLOSURE:
+    case INTERNAL_QUOTE:
+    case INTERNAL_SYNTAX:
+    case INTERNAL_DATA:
+      return value.object;
+    case INTERNAL_REFERENCE:
+      if (value.type == box_type) {
+        return value.object;
+      }
+      return NULL;
+    default:
+      return NULL;
+  }
+}
+
+/* Returns the values referenced by a value for which `get_object()` is not
+ * NULL. */
+static Slice get_children(NseVal value, NseVal buffer[]) {
+  switch (value.type->internal) {
+    case INTERNAL_CONS:
+      buffer[0] = value.cons->head;
+      buffer[1] = value.cons->tail;
+      return SLICE(buffer, 2);
+    case INTERNAL_LIST_BUILDER:
+      if (value.list_builder->first) {
+        buffer[0] = CONS(value.list_builder->first);
+        return SLICE(buffer, 1);
+      }
+      return SLICE(buffer, 0);
+    case INTERNAL_CLOSURE:
+      return SLICE(value.closure->env, value.closure->env_size);
+    case INTERNAL_QUOTE:
+      return SLICE(&value.quote->quoted, 1);
+    case INTERNAL_SYNTAX:
+      return SLICE(&value.syntax->quoted, 1);
+    case INTERNAL_DATA:
+      return SLICE(value.data->record, value.data->record_size);
+    case INTERNAL_REFERENCE:
+      return SLICE(value.reference->pointer, 1);
+    default:
+      return SLICE(buffer, 0);
+  }
+}
+
+static int push_node(Collector *c, size_t index) {
+  if (c->stack_size >= c->capacity) {
+    // The stack never holds more indices than there are nodes
+    return 0;
+  }
+  c->stack[c->stack_size++] = index;
+  return 1;
+}
+
+/* Returns the index of the node of a value plus one, adding and pushing a new
+ * node if the value has not been visited. Returns 0 if allocation fails. */
+static size_t visit(Collector *c, NseVal value) {
+  size_t index = node_map_lookup(c->map, get_object(value));
+  if (index) {
+    return index;
+  }
+  if (c->size >= c->capacity) {
+    size_t capacity = c->capacity ? c->capacity * 2 : 64;
+    Node *nodes = realloc(c->nodes, sizeof(Node) * capacity);
+    if (!nodes) {
+      return 0;
+    }
+    c->nodes = nodes;
+    size_t *stack = realloc(c->stack, sizeof(size_t) * capacity);
+    if (!stack) {
+      return 0;
+    }
+    c->stack = stack;
+    c->capacity = capacity;
+  }
+  c->nodes[c->size] = (Node){ .value = value, .count = get_object(value)->refs, .color = NODE_GRAY };
+  if (!node_map_add(c->map, get_object(value), c->size + 1)) {
+    return 0;
+  }
+  push_node(c, c->size);
+  return ++c->size;
+}
+
+/* Visits the values reachable from the boxes and subtracts the references
+ * between them from their counts. */
+static int mark_gray(Collector *c) {
+  for (Box *box = boxes; box; box = box->next) {
+    if (!visit(c, REFERENCE(box->reference))) {
+      return 0;
+    }
+    while (c->stack_size > 0) {
+      NseVal buffer[2];
+      Slice children = get_children(c->nodes[c->stack[--c->stack_size]].value, buffer);
+      for (size_t i = 0; i < children.length; i++) {
+        if (!RESULT_OK(children.cells[i]) || !get_object(children.cells[i])) {
+          continue;
+        }
+        size_t index = visit(c, children.cells[i]);
+        if (!index) {
+          return 0;
+        }
+        c->nodes[index - 1].count--;
+      }
+    }
+  }
+  return 1;
+}
+
+/* Marks the values that are referenced from outside the visited values, and
+ * the values reachable from them, black. */
+static void scan_black(Collector *c) {
+  for (size_t i = 0; i < c->size; i++) {
+    if (c->nodes[i].color == NODE_BLACK || c->nodes[i].count == 0) {
+      continue;
+    }
+    c->nodes[i].color = NODE_BLACK;
+    push_node(c, i);
+    while (c->stack_size > 0) {
+      NseVal buffer[2];
+      Slice children = get_children(c->nodes[c->stack[--c->stack_size]].value, buffer);
+      for (size_t j = 0; j < children.length; j++) {
+        if (!RESULT_OK(children.cells[j]) || !get_object(children.cells[j])) {
+          continue;
+        }
+        size_t index = node_map_lookup(c->map, get_object(children.cells[j])) - 1;
+        if (c->nodes[index].color == NODE_GRAY) {
+          c->nodes[index].color = NODE_BLACK;
+          push_node(c, index);
+        }
+      }
+    }
+  }
+}
+
+/* Empties the boxes that are garbage, after which reference counting deletes
+ * the rest of the cycles. */
+static void clear_boxes(Collector *c) {
+  for (size_t i = 0; i < c->size; i++) {
+    if (c->nodes[i].color == NODE_GRAY && c->nodes[i].value.type == box_type) {
+      add_ref(c->nodes[i].value);
+      push_node(c, i);
+    }
+  }
+  for (size_t i = 0; i < c->stack_size; i++) {
+    set_box(c->nodes[c->stack[i]].value, undefined);
+  }
+  for (size_t i = 0; i < c->stack_size; i++) {
+    del_ref(c->nodes[c->stack[i]].value);
+  }
+  c->stack_size = 0;
+}
+
+size_t collect_cycles() {
+  flush_deleted();
+  boxes_created = 0;
+  Collector c = { .map = create_node_map(), .nodes = NULL, .size = 0, .capacity = 0, .stack = NULL,
+    .stack_size = 0 };
+  size_t garbage = 0;
+  if (mark_gray(&c)) {
+    scan_black(&c);
+    for (size_t i = 0; i < c.size; i++) {
+      garbage += c.nodes[i].color == NODE_GRAY;
+    }
+    clear_boxes(&c);
+  }
+  delete_node_map(c.map);
+  free(c.nodes);
+  free(c.stack);
+  // Let the number of boxes created before the next collection grow with the
+  // number of values that survived, so that collecting takes amortized
+  // constant time per box
+  size_t survivors = c.size - garbage;
+  collect_threshold = survivors > COLLECT_THRESHOLD ? survivors : COLLECT_THRESHOLD;
+  return garbage;
+}
+
+size_t collect_cycles_if_needed() {
+  if (boxes_created >= collect_threshold) {
+    return collect_cycles();
+  }
+  return 0;
+}
+
+DEFINE_HASH_MAP(node_map, NodeMap, void *, size_t, pointer_hash, pointer_equals)
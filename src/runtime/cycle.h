@@ -0,0 +1,59 @@
+#ifndef CYCLE_H
+#define CYCLE_H
+
+#include "value.h"
+
+/* Cycle collection.
+ *
+ * Reference counting alone reclaims everything except cycles created through
+ * boxes: the mutable cells that let-forms use for variables that are
+ * referenced before they are bound, e.g. recursive local functions. Every box
+ * is registered when it is created, and `collect_cycles()` uses trial deletion
+ * over the values reachable from the registered boxes to find the ones that
+ * are only referenced from within cycles.
+ *
+ * The only other mutation is `update-head`, which reuses a cons in place when
+ * its single reference is the argument being consumed. The new head already
+ * exists when the cons is updated, so it can only refer back to the cons
+ * through another reference, which would have made the cons shared. A cycle
+ * that is later closed through such a cell passes through a box, from which
+ * the cell is reachable, so the cells themselves need not be registered.
+ *
+ * A let-bound function whose only references to itself are self-calls in tail
+ * position is compiled to a loop without a box, so the common recursive helper
+ * functions never form cycles.
+ *
+ * Trial deletion frees values whose remaining references all come from
+ * garbage, which is unsafe while C code holds borrowed pointers that are not
+ * backed by a counted reference. When the evaluator calls or returns from a
+ * function, every value in use is referenced by a frame slot, an argument list
+ * or a pending result. Automatic collection therefore runs when a lambda
+ * returns and between top-level forms, see `collect_cycles_if_needed()`, and
+ * the `collect-cycles` function may be called anywhere. */
+
+typedef struct Box Box;
+
+/* The contents of a box reference. */
+struct Box {
+  /* First, so that the pointer of a box reference can be read as an
+   * `NseVal *`. */
+  NseVal value;
+  Reference *reference;
+  Box *previous;
+  Box *next;
+};
+
+/* Creates a registered box holding undefined. Returns undefined if allocation
+ * fails. */
+NseVal create_box();
+/* Sets the value of a box, the box takes a reference to the value. */
+void set_box(NseVal box, NseVal value);
+/* Deletes the garbage cycles reachable from boxes. Returns the number of values
+ * found to be garbage. */
+size_t collect_cycles();
+/* Calls `collect_cycles()` if enough boxes have been created since the last
+ * collection. Must only be called at a safe point, where every value that is
+ * in use is held by a counted reference. */
+size_t collect_cycles_if_needed();
+
+#endif
@@ -15,8 +15,16 @@ Symbol *syntax_error = NULL;
 
 Module *error_module = NULL;
 
-static char *alloc_error = "out of memory: could not allocate enough space for error message";
-static char *error_string = NULL;
+#define ERROR_BUFFER_SIZE 256
+
+static const char *alloc_error = "out of memory: could not allocate enough space for error message";
+static const char *error_string = NULL;
+/* Buffer for formatted error messages, messages that do not fit are
+ * allocated. The next call to `raise_error()` overwrites the message, so a
+ * caller that keeps the result of `current_error()` must copy it first. */
+static char error_buffer[ERROR_BUFFER_SIZE];
+/* 1 if `error_string` was allocated. */
+static int error_string_allocated = 0;
 static Symbol *error_symbol = NULL;
 
 void init_error_module() {
@@ -33,39 +41,32 @@ void init_error_module() {
 void raise_error(Symbol *error_type, const char *format, ...) {
   va_list va;
   clear_error();
-  char *buffer = malloc(50);
+  record_error_form();
+  error_symbol = add_ref(SYMBOL(error_type)).symbol;
+  if (!strchr(format, '%')) {
+    // Most errors, e.g. failed pattern matches, have constant messages
+    error_string = format;
+    return;
+  }
+  va_start(va, format);
+  int n = vsnprintf(error_buffer, ERROR_BUFFER_SIZE, format, va);
+  va_end(va);
+  if (n >= 0 && n < ERROR_BUFFER_SIZE) {
+    error_string = error_buffer;
+    return;
+  }
+  char *buffer = n < 0 ? NULL : malloc(n + 1);
   if (!buffer) {
     error_string = alloc_error;
+    del_ref(SYMBOL(error_symbol));
     error_symbol = add_ref(SYMBOL(out_of_memory_error)).symbol;
     return;
   }
-  size_t size = 50;
-  while (1) {
-    va_start(va, format);
-    int n = vsnprintf(buffer, size, format, va);
-    va_end(va);
-    if (n < 0) {
-      error_string = alloc_error;
-      error_symbol = add_ref(SYMBOL(out_of_memory_error)).symbol;
-      break;
-    }
-    if (n < size) {
-      error_string = buffer;
-      error_symbol = add_ref(SYMBOL(error_type)).symbol;
-      break;
-    }
-    size_t new_size = n + 1;
-    char *new_buffer = malloc(new_size);
-    if (!new_buffer) {
-      error_string = alloc_error;
-      error_symbol = add_ref(SYMBOL(out_of_memory_error)).symbol;
-      break;
-    }
-    memcpy(new_buffer, buffer, size);
-    free(buffer);
-    buffer = new_buffer;
-    size = new_size;
-  }
+  va_start(va, format);
+  vsnprintf(buffer, n + 1, format, va);
+  va_end(va);
+  error_string = buffer;
+  error_string_allocated = 1;
 }
 
 const char *current_error() {
@@ -77,12 +78,11 @@ Symbol *current_error_type() {
 }
 
 void clear_error() {
-  if (error_string) {
-    if (error_string != alloc_error) {
-      free(error_string);
-    }
-    error_string = NULL;
+  if (error_string_allocated) {
+    free((char *)error_string);
+    error_string_allocated = 0;
   }
+  error_string = NULL;
   if (error_symbol) {
     del_ref(SYMBOL(error_symbol));
     error_symbol = NULL;
@@ -13,7 +13,11 @@ extern Symbol *io_error;
 extern Symbol *syntax_error;
 
 void init_error_module();
+/* Raises an error. The format should be a string literal, since a format
+ * without conversions is used as the message without being copied. */
 void raise_error(Symbol *error_type, const char *format, ...);
+/* Returns the message of the current error. The message is only valid until
+ * the next call to `raise_error()` or `clear_error()`. */
 const char *current_error();
 Symbol *current_error_type();
 void clear_error();
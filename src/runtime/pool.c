@@ -0,0 +1,80 @@
+#include <stdlib.h>
+
+#include "error.h"
+
+#include "pool.h"
+
+/* Size of a slab in bytes. */
+#define SLAB_SIZE 16384
+
+typedef struct FreeObject FreeObject;
+typedef struct Pool Pool;
+
+struct FreeObject {
+  FreeObject *next;
+};
+
+struct Pool {
+  /* Most recently freed object. */
+  FreeObject *free_list;
+  /* Unused part of the current slab. */
+  char *next;
+  char *end;
+  PoolStats stats;
+};
+
+static Pool pools[POOL_CLASSES];
+
+static Pool *get_pool(size_t bytes) {
+  size_t index = bytes ? (bytes - 1) / POOL_GRANULARITY : 0;
+  return &pools[index];
+}
+
+static void *allocate_from_slab(Pool *pool, size_t size) {
+  if (pool->next == pool->end) {
+    size_t count = SLAB_SIZE / size;
+    char *slab = allocate(size * count);
+    if (!slab) {
+      return NULL;
+    }
+    pool->next = slab;
+    pool->end = slab + size * count;
+    pool->stats.slabs++;
+  }
+  void *object = pool->next;
+  pool->next += size;
+  return object;
+}
+
+void *pool_allocate(size_t bytes) {
+  Pool *pool = get_pool(bytes);
+  void *object;
+  if (pool->free_list) {
+    object = pool->free_list;
+    pool->free_list = pool->free_list->next;
+  } else {
+    object = allocate_from_slab(pool, (pool - pools + 1) * POOL_GRANULARITY);
+    if (!object) {
+      return NULL;
+    }
+  }
+  pool->stats.live++;
+  if (pool->stats.live > pool->stats.peak) {
+    pool->stats.peak = pool->stats.live;
+  }
+  return object;
+}
+
+void pool_free(void *object, size_t bytes) {
+  Pool *pool = get_pool(bytes);
+  FreeObject *free_object = object;
+  free_object->next = pool->free_list;
+  pool->free_list = free_object;
+  pool->stats.live--;
+}
+
+PoolStats get_pool_stats(size_t index) {
+  PoolStats stats = pools[index].stats;
+  stats.size = (index + 1) * POOL_GRANULARITY;
+  return stats;
+}
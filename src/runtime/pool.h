@@ -0,0 +1,42 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdlib.h>
+
+/* Pools for small fixed-size objects, e.g. conses, quotes, syntax objects,
+ * scopes and bindings.
+ *
+ * Objects are grouped into size classes of POOL_GRANULARITY bytes. Each class
+ * carves objects out of slabs allocated with `allocate()` and recycles freed
+ * objects through a free list, so objects are never returned to malloc. */
+
+/* Largest object size served by the pools. */
+#define POOL_MAX_SIZE 64
+#define POOL_GRANULARITY 8
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULARITY)
+
+typedef struct PoolStats PoolStats;
+
+/* Allocation counts of a size class. */
+struct PoolStats {
+  /* Object size of the class. */
+  size_t size;
+  /* Number of objects currently allocated. */
+  size_t live;
+  /* Largest number of objects allocated at any time. */
+  size_t peak;
+  /* Number of slabs allocated for the class. */
+  size_t slabs;
+};
+
+/* Allocates an object of at most POOL_MAX_SIZE bytes. Raises an error and
+ * returns NULL if allocation fails. */
+void *pool_allocate(size_t bytes);
+/* Returns an object to its pool. `bytes` must be the size it was allocated
+ * with. */
+void pool_free(void *object, size_t bytes);
+/* Returns the allocation counts of the size class with index `index`, where
+ * `index` is less than POOL_CLASSES. */
+PoolStats get_pool_stats(size_t index);
+
+#endif
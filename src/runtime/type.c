@@ -71,6 +71,8 @@ CType *func_type;
 CType *scope_type;
 CType *stream_type;
 CType *generic_type_type;
+CType *code_type;
+CType *box_type;
 
 GType *list_type;
 
@@ -102,6 +104,16 @@ void init_types() {
   scope_type = create_simple_type(INTERNAL_REFERENCE, any_type);
   stream_type = create_simple_type(INTERNAL_REFERENCE, any_type);
   generic_type_type = create_simple_type(INTERNAL_REFERENCE, any_type);
+  code_type = create_simple_type(INTERNAL_REFERENCE, any_type);
+  box_type = create_simple_type(INTERNAL_REFERENCE, any_type);
+  CType *built_in[] = { any_type, bool_type, improper_list_type, proper_list_type, nil_type, nil_type->super,
+    list_builder_type, num_type, int_type, float_type, i64_type, f64_type, string_type, symbol_type, keyword_type,
+    quote_type, continue_type, type_quote_type, syntax_type, type_type, func_type, scope_type, stream_type,
+    generic_type_type, code_type, box_type };
+  for (size_t i = 0; i < sizeof(built_in) / sizeof(CType *); i++) {
+    built_in[i]->refs = IMMORTAL_REFS;
+  }
+  list_type->refs = IMMORTAL_REFS;
 }
 
 CType *create_simple_type(InternalType internal, CType *super) {
@@ -157,14 +169,14 @@ CType *create_poly_var(GType *g, int index) {
 }
 
 GType *copy_generic(GType *g) {
-  if (g) {
+  if (g && g->refs != IMMORTAL_REFS) {
     g->refs++;
   }
   return g;
 }
 
 void delete_generic(GType *g) {
-  if (!g) {
+  if (!g || g->refs == IMMORTAL_REFS) {
     return;
   }
   g->refs--;
@@ -182,14 +194,14 @@ void delete_generic(GType *g) {
 }
 
 CType *copy_type(CType *t) {
-  if (t) {
+  if (t && t->refs != IMMORTAL_REFS) {
     t->refs++;
   }
   return t;
 }
 
 void delete_type(CType *t) {
-  if (!t) {
+  if (!t || t->refs == IMMORTAL_REFS) {
     return;
   }
   t->refs--;
@@ -441,20 +453,24 @@ CType *get_super_type(const CType *t) {
   return copy_type(t->super);
 }
 
-int is_subtype_of(const CType *a, const CType *b) {
-  while (a) {
+int subtype_distance(const CType *a, const CType *b) {
+  for (int distance = 0; a; distance += 2) {
     if (a == b) {
-      return 1;
+      return distance;
     } else if (a->type == C_TYPE_POLY_INSTANCE && b->type == C_TYPE_INSTANCE
         && a->poly_instance == b->instance.type) {
-      return 1;
+      return distance + 1;
     } else if (b->type == C_TYPE_POLY_INSTANCE && a->type == C_TYPE_INSTANCE
         && b->poly_instance == a->instance.type) {
-      return 1;
+      return distance + 1;
     }
     a = a->super;
   }
-  return 0;
+  return -1;
+}
+
+int is_subtype_of(const CType *a, const CType *b) {
+  return subtype_distance(a, b) >= 0;
 }
 
 const CType *unify_types(const CType *a, const CType *b) {
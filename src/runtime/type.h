@@ -4,6 +4,8 @@
 #ifndef NSE_TYPE_H
 #define NSE_TYPE_H
 
+#include <stdint.h>
+
 /* NSE type system.
  *
  * # Reference counting of concrete and generic types
@@ -34,6 +36,12 @@
  *       f(t); // OK, move to f
  *       // t may no longer be used in h
  *     }
+ *
+ * # Immortal objects
+ *
+ * The built-in types and interned symbols are never deleted. Their reference
+ * counts are set to `IMMORTAL_REFS`, which the copy and delete functions leave
+ * unchanged, so copying and deleting them doesn't write to memory.
  */
 
 typedef struct Symbol Symbol;
@@ -42,22 +50,26 @@ typedef struct CType CType;
 typedef struct GType GType;
 typedef struct CTypeArray CTypeArray;
 
-/* Internal value types. */
+/* Reference count of an immortal type or object. */
+#define IMMORTAL_REFS SIZE_MAX
+
+/* Internal value types. Values of the types from INTERNAL_CONS and onward
+ * point to an `Object` header. */
 typedef enum {
   INTERNAL_NOTHING,
   INTERNAL_NIL,
-  INTERNAL_CONS,
-  INTERNAL_LIST_BUILDER,
   INTERNAL_I64,
   INTERNAL_F64,
   INTERNAL_FUNC,
+  INTERNAL_TYPE,
+  INTERNAL_CONS,
+  INTERNAL_LIST_BUILDER,
   INTERNAL_CLOSURE,
   INTERNAL_GFUNC,
   INTERNAL_STRING,
   INTERNAL_SYNTAX,
   INTERNAL_SYMBOL,
   INTERNAL_REFERENCE,
-  INTERNAL_TYPE,
   INTERNAL_QUOTE,
   INTERNAL_DATA,
 } InternalType;
@@ -75,7 +87,7 @@ typedef enum {
 
 /* Concrete type structure. */
 struct CType {
-  /* Number of references. */
+  /* Number of references or IMMORTAL_REFS. */
   size_t refs;
   /* Type of type. */
   CTypeType type;
@@ -163,6 +175,10 @@ extern CType *scope_type;
 extern CType *stream_type;
 /* generic-type < any */
 extern CType *generic_type_type;
+/* code < any */
+extern CType *code_type;
+/* box < any */
+extern CType *box_type;
 
 /* Generic list type. */
 extern GType *list_type;
@@ -288,6 +304,10 @@ CType *instantiate_type(CType *t, const GType *g, const CTypeArray *parameters);
 CType *get_super_type(const CType *t);
 /* Returns 1 if `a` is a subtype of or equal to `b`, 0 otherwise. */
 int is_subtype_of(const CType *a, const CType *b);
+/* Returns the distance from `a` to `b` along the supertype chain of `a`, or -1
+ * if `a` is not a subtype of `b`. Every step counts as 2, and matching a
+ * polymorphic instance counts as 1 more than matching a type exactly. */
+int subtype_distance(const CType *a, const CType *b);
 /* Returns a common supertype for types `a` and `b`.
  * `any_type` is returned if no such common supertype can be found. */
 const CType *unify_types(const CType *a, const CType *b);
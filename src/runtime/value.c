@@ -4,23 +4,70 @@
 
 #include "hashmap.h"
 #include "error.h"
+#include "pool.h"
 #include "../write.h"
+#include "../eval.h"
 
 #include "value.h"
 
 static void delete(NseVal value);
 
+_Static_assert(sizeof(NseVal) == 2 * sizeof(void *), "NseVal must be two words");
+_Static_assert(sizeof(Cons) <= POOL_MAX_SIZE, "Cons must fit in a pool");
+_Static_assert(sizeof(Quote) <= POOL_MAX_SIZE, "Quote must fit in a pool");
+_Static_assert(sizeof(Syntax) <= POOL_MAX_SIZE, "Syntax must fit in a pool");
+
 NseVal undefined = { .type = NULL };
 NseVal nil;
 
+Syntax *current_form = NULL;
 Syntax *error_form = NULL;
-
-NseVal stack_trace;
+/* 1 if `error_form` was set by `set_debug_form()` for the next error. */
+static int error_form_set = 0;
+
+/* A function application in progress, see `nse_call()`. The function and
+ * arguments are borrowed from the caller until the application fails, at which
+ * point the frame becomes part of the stack trace and takes references to
+ * them. */
+typedef struct {
+  NseVal func;
+  Slice args;
+  /* The form that applied the function or NULL. */
+  Syntax *form;
+  /* The arguments as a list, set when the frame is part of the stack trace. */
+  NseVal arg_list;
+} CallFrame;
+
+#define CALL_STACK_INITIAL_SIZE 64
+
+/* Frames below `call_stack_size` are active. Frames from `call_stack_size` up
+ * to `stack_trace_top` are the failed applications that make up the stack
+ * trace of the current error, the trace is empty if `stack_trace_top` is not
+ * above `call_stack_size`. */
+static CallFrame *call_stack = NULL;
+static size_t call_stack_size = 0;
+static size_t call_stack_capacity = 0;
+static size_t stack_trace_top = 0;
+
+#define DELETE_QUEUE_INITIAL_SIZE 64
+/* Maximum number of queued objects deleted by one `del_ref()`. */
+#define DELETE_BUDGET 4096
+
+/* Objects whose reference counts have reached zero while another object was
+ * being deleted. Queueing them instead of deleting them recursively means that
+ * deleting a long list does not use stack space proportional to its length.
+ * Each `del_ref()` that drops an object deletes at most DELETE_BUDGET queued
+ * objects, so a large structure is deleted in increments by subsequent
+ * deletions. */
+static NseVal *delete_queue = NULL;
+static size_t delete_queue_size = 0;
+static size_t delete_queue_capacity = 0;
+/* 1 while an object is being deleted. */
+static int deleting = 0;
 
 void init_values() {
   init_types();
   nil = (NseVal){ .type = nil_type };
-  stack_trace = nil;
 }
 
 void set_debug_form(NseVal form) {
@@ -32,50 +79,42 @@ void set_debug_form(NseVal form) {
     if (error_form) {
       add_ref(SYNTAX(error_form));
     }
+    error_form_set = 1;
   }
 }
 
-Syntax *push_debug_form(Syntax *syntax) {
-  Syntax *previous = error_form;
-  error_form = syntax;
-  if (error_form) {
-    add_ref(SYNTAX(error_form));
+void record_error_form() {
+  if (!error_form_set && error_form != current_form) {
+    if (error_form) {
+      del_ref(SYNTAX(error_form));
+    }
+    error_form = current_form;
+    if (error_form) {
+      add_ref(SYNTAX(error_form));
+    }
   }
+  error_form_set = 0;
+  clear_stack_trace();
+}
+
+Syntax *push_debug_form(Syntax *syntax) {
+  Syntax *previous = current_form;
+  current_form = syntax;
   return previous;
 }
 
 NseVal pop_debug_form(NseVal result, Syntax *previous) {
-  if (!RESULT_OK(result)) {
-    if (previous) {
-      del_ref(SYNTAX(previous));
-    }
-    return result;
-  }
-  if (error_form) {
-    del_ref(SYNTAX(error_form));
-  }
-  error_form = previous;
+  current_form = previous;
   return result;
 }
 
 Cons *create_cons(NseVal h, NseVal t) {
-  Cons *cons = allocate(sizeof(Cons));
+  Cons *cons = pool_allocate(sizeof(Cons));
   if (!cons) {
     return NULL;
   }
-  cons->refs = 1;
-  if (t.type == nil_type) {
-    cons->type = get_unary_instance(copy_generic(list_type), copy_type(h.type));
-  } else if (t.type->type == C_TYPE_INSTANCE && t.type->instance.type == list_type) {
-    CType *existing = t.type->instance.parameters->elements[0];
-    if (existing == h.type) {
-      cons->type = copy_type(t.type);
-    } else {
-      cons->type = get_unary_instance(copy_generic(list_type), copy_type((CType *)unify_types(h.type, existing)));
-    }
-  } else {
-    cons->type = copy_type(improper_list_type);
-  }
+  cons->header.refs = 1;
+  cons->type = NULL;
   cons->head = h;
   cons->tail = t;
   add_ref(h);
@@ -88,7 +127,7 @@ ListBuilder *create_list_builder() {
   if (!lb) {
     return NULL;
   }
-  lb->refs = 1;
+  lb->header.refs = 1;
   lb->first = NULL;
   lb->last = NULL;
   lb->copied = 0;
@@ -96,11 +135,11 @@ ListBuilder *create_list_builder() {
 }
 
 Quote *create_quote(NseVal quoted) {
-  Quote *quote = allocate(sizeof(Quote));
+  Quote *quote = pool_allocate(sizeof(Quote));
   if (!quote) {
     return NULL;
   }
-  quote->refs = 1;
+  quote->header.refs = 1;
   quote->quoted = quoted;
   add_ref(quoted);
   return quote;
@@ -115,11 +154,11 @@ Continue *create_continue(NseVal args) {
 }
 
 Syntax *create_syntax(NseVal quoted) {
-  Syntax *syntax = allocate(sizeof(Syntax));
+  Syntax *syntax = pool_allocate(sizeof(Syntax));
   if (!syntax) {
     return NULL;
   }
-  syntax->refs = 1;
+  syntax->header.refs = 1;
   syntax->start_line = 0;
   syntax->start_column = 0;
   syntax->end_line = 0;
@@ -136,8 +175,10 @@ Symbol *create_symbol(const char *s, Module *module) {
   if (!symbol) {
     return NULL;
   }
-  symbol->refs = 1;
+  symbol->header.refs = 1;
   symbol->module = module;
+  symbol->special = SPECIAL_NONE;
+  symbol->macro = 0;
   memcpy(symbol->name, s, len);
   symbol->name[len] = '\0';
   return symbol;
@@ -153,20 +194,20 @@ String *create_string(const char *s, size_t length) {
   if (!str) {
     return NULL;
   }
-  str->refs = 1;
+  str->header.refs = 1;
   str->length = length;
   memcpy(str->chars, s, length);
   str->chars[length] = '\0';
   return str;
 }
 
-Closure *create_closure(NseVal f(NseVal, NseVal[]), CType *type, NseVal env[], size_t env_size) {
+Closure *create_closure(NseVal f(Slice, NseVal[]), CType *type, NseVal env[], size_t env_size) {
   Closure *closure = allocate(sizeof(Closure) + env_size * sizeof(NseVal));
   if (!closure) {
     delete_type(type);
     return NULL;
   }
-  closure->refs = 1;
+  closure->header.refs = 1;
   closure->f = f;
   closure->type = type;
   closure->doc = NULL;
@@ -186,22 +227,40 @@ GFunc *create_gfunc(Symbol *name, CType *type, Module *context) {
     delete_type(type);
     return NULL;
   }
-  g_func->refs = 1;
+  g_func->header.refs = 1;
   g_func->name = name;
   add_ref(SYMBOL(name));
   g_func->type = type;
   g_func->doc = NULL;
   g_func->context = context;
+  g_func->dispatch = NULL;
+  g_func->bound = NULL;
+  g_func->next_bound = NULL;
   return g_func;
 }
 
+GFunc *bind_gfunc(GFunc *g, Module *context) {
+  for (GFunc *bound = g->bound; bound; bound = bound->next_bound) {
+    if (bound->context == context) {
+      return bound;
+    }
+  }
+  GFunc *bound = create_gfunc(g->name, copy_type(g->type), context);
+  if (!bound) {
+    return NULL;
+  }
+  bound->next_bound = g->bound;
+  g->bound = bound;
+  return bound;
+}
+
 Reference *create_reference(CType *type, void *pointer, void destructor(void *)) {
   Reference *reference = allocate(sizeof(Reference));
   if (!reference) {
     delete_type(type);
     return NULL;
   }
-  reference->refs = 1;
+  reference->header.refs = 1;
   reference->type = type;
   reference->pointer = pointer;
   reference->destructor = destructor;
@@ -217,7 +276,7 @@ Data *create_data(CType *type, Symbol *tag, NseVal record[], size_t record_size)
     delete_type(type);
     return NULL;
   }
-  data->refs = 1;
+  data->header.refs = 1;
   data->type = type;
   add_ref(SYMBOL(tag));
   data->tag = tag;
@@ -271,95 +330,68 @@ NseVal check_alloc(NseVal v) {
 }
 
 NseVal add_ref(NseVal value) {
-  if (!value.type) {
-    return value;
-  }
-  switch (value.type->internal) {
-    case INTERNAL_CONS:
-      value.cons->refs++;
-      break;
-    case INTERNAL_LIST_BUILDER:
-      value.list_builder->refs++;
-      break;
-    case INTERNAL_CLOSURE:
-      value.closure->refs++;
-      break;
-    case INTERNAL_GFUNC:
-      value.gfunc->refs++;
-      break;
-    case INTERNAL_QUOTE:
-      value.quote->refs++;
-      break;
-    case INTERNAL_SYMBOL:
-      value.symbol->refs++;
-      break;
-    case INTERNAL_STRING:
-      value.string->refs++;
-      break;
-    case INTERNAL_SYNTAX:
-      value.syntax->refs++;
-      break;
-    case INTERNAL_REFERENCE:
-      value.reference->refs++;
-      break;
-    case INTERNAL_TYPE:
-      copy_type(value.type_val);
-      break;
-    case INTERNAL_DATA:
-      value.data->refs++;
-      break;
-    default:
-      break;
+  if (IS_OBJECT(value)) {
+    if (value.object->refs != IMMORTAL_REFS) {
+      value.object->refs++;
+    }
+  } else if (value.type && value.type->internal == INTERNAL_TYPE) {
+    copy_type(value.type_val);
   }
   return value;
 }
 
-void del_ref(NseVal value) {
-  if (!value.type) {
+void flush_deleted() {
+  if (deleting) {
     return;
   }
-  size_t *refs = NULL;
-  switch (value.type->internal) {
-    case INTERNAL_CONS:
-      refs = &value.cons->refs;
-      break;
-    case INTERNAL_CLOSURE:
-      refs = &value.closure->refs;
-      break;
-    case INTERNAL_LIST_BUILDER:
-      refs = &value.list_builder->refs;
-    case INTERNAL_GFUNC:
-      refs = &value.gfunc->refs;
-      break;
-    case INTERNAL_QUOTE:
-      refs = &value.quote->refs;
-      break;
-    case INTERNAL_SYMBOL:
-      refs = &value.symbol->refs;
-      break;
-    case INTERNAL_STRING:
-      refs = &value.string->refs;
-      break;
-    case INTERNAL_SYNTAX:
-      refs = &value.syntax->refs;
-      break;
-    case INTERNAL_REFERENCE:
-      refs = &value.reference->refs;
-      break;
-    case INTERNAL_TYPE:
+  deleting = 1;
+  while (delete_queue_size > 0) {
+    delete(delete_queue[--delete_queue_size]);
+  }
+  deleting = 0;
+}
+
+/* Queues an object for deletion. Returns 0 if the queue could not be
+ * grown. */
+static int queue_delete(NseVal value) {
+  if (delete_queue_size >= delete_queue_capacity) {
+    size_t capacity = delete_queue_capacity ? delete_queue_capacity * 2 : DELETE_QUEUE_INITIAL_SIZE;
+    NseVal *queue = realloc(delete_queue, sizeof(NseVal) * capacity);
+    if (!queue) {
+      return 0;
+    }
+    delete_queue = queue;
+    delete_queue_capacity = capacity;
+  }
+  delete_queue[delete_queue_size++] = value;
+  return 1;
+}
+
+void del_ref(NseVal value) {
+  if (!IS_OBJECT(value)) {
+    if (value.type && value.type->internal == INTERNAL_TYPE) {
       delete_type(value.type_val);
-      return;
-    case INTERNAL_DATA:
-      refs = &value.data->refs;
-      break;
-    default:
-      return;
+    }
+    return;
+  }
+  if (value.object->refs == IMMORTAL_REFS) {
+    return;
+  }
+  if (value.object->refs == 0) {
+    // Released more times than it was referenced, don't delete it twice
+    return;
   }
-  if (*refs > 0) {
-    // error if already deleted?
-    (*refs)--;
+  if (--value.object->refs > 0) {
+    return;
   }
-  if (*refs == 0) {
+  if (!deleting) {
+    deleting = 1;
+    delete(value);
+    for (size_t budget = DELETE_BUDGET; budget > 0 && delete_queue_size > 0; budget--) {
+      delete(delete_queue[--delete_queue_size]);
+    }
+    deleting = 0;
+  } else if (!queue_delete(value)) {
     delete(value);
   }
 }
@@ -369,7 +401,8 @@ static void delete(NseVal value) {
     case INTERNAL_CONS:
       del_ref(value.cons->head);
       del_ref(value.cons->tail);
-      free(value.cons);
+      delete_type(value.cons->type);
+      pool_free(value.cons, sizeof(Cons));
       return;
     case INTERNAL_LIST_BUILDER:
       if (value.list_builder->first) {
@@ -382,7 +415,7 @@ static void delete(NseVal value) {
       return;
     case INTERNAL_QUOTE:
       del_ref(value.quote->quoted);
-      free(value.quote);
+      pool_free(value.quote, sizeof(Quote));
       return;
     case INTERNAL_STRING:
       free(value.string);
@@ -392,7 +425,7 @@ static void delete(NseVal value) {
         del_ref(STRING(value.syntax->file));
       }
       del_ref(value.syntax->quoted);
-      free(value.syntax);
+      pool_free(value.syntax, sizeof(Syntax));
       return;
     case INTERNAL_CLOSURE:
       if (value.closure->doc) {
@@ -405,8 +438,15 @@ static void delete(NseVal value) {
       free(value.closure);
       return;
     case INTERNAL_GFUNC:
+      for (GFunc *bound = value.gfunc->bound; bound;) {
+        GFunc *next = bound->next_bound;
+        bound->next_bound = NULL;
+        del_ref(GFUNC(bound));
+        bound = next;
+      }
       del_ref(SYMBOL(value.gfunc->name));
       delete_type(value.gfunc->type);
+      free(value.gfunc->dispatch);
       free(value.gfunc);
       return;
     case INTERNAL_REFERENCE:
@@ -490,6 +530,23 @@ int is_list(NseVal v) {
   return 0;
 }
 
+int is_proper_list(NseVal v) {
+  while (1) {
+    switch (v.type->internal) {
+      case INTERNAL_NIL:
+        return 1;
+      case INTERNAL_CONS:
+        v = v.cons->tail;
+        break;
+      case INTERNAL_SYNTAX:
+        v = v.syntax->quoted;
+        break;
+      default:
+        return 0;
+    }
+  }
+}
+
 int is_i64(NseVal v) {
   if (v.type->internal == INTERNAL_I64) {
     return 1;
@@ -582,7 +639,7 @@ int is_data(NseVal v) {
 }
 
 NseVal from_cons(Cons *c) {
-  return (NseVal){ .type = c->type, .cons = c };
+  return (NseVal){ .type = improper_list_type, .cons = c };
 }
 
 NseVal from_closure(Closure *c) {
@@ -601,6 +658,73 @@ NseVal from_data(Data *d) {
   return (NseVal){ .type = d->type, .data = d };
 }
 
+static CType *get_cons_type(Cons *cons, NseVal tail) {
+  CType *h = get_type(cons->head);
+  if (tail.type == nil_type) {
+    return get_unary_instance(copy_generic(list_type), copy_type(h));
+  }
+  if (tail.type->internal == INTERNAL_CONS) {
+    CType *t = tail.cons->type;
+    if (t->type == C_TYPE_INSTANCE && t->instance.type == list_type) {
+      CType *existing = t->instance.parameters->elements[0];
+      if (existing == h) {
+        return copy_type(t);
+      }
+      return get_unary_instance(copy_generic(list_type), copy_type((CType *)unify_types(h, existing)));
+    }
+  }
+  return copy_type(improper_list_type);
+}
+
+CType *get_type(NseVal v) {
+  if (v.type->internal != INTERNAL_CONS) {
+    return v.type;
+  } else if (v.cons->type) {
+    return v.cons->type;
+  }
+  // The type of a cell depends on the type of its tail, so the untyped cells
+  // are collected first and then typed from the end of the list.
+  Cons *buffer[32];
+  Cons **cells = buffer;
+  size_t capacity = 32;
+  size_t length = 0;
+  NseVal tail = v;
+  while (tail.type->internal == INTERNAL_CONS && !tail.cons->type) {
+    if (length == capacity) {
+      Cons **new_cells = allocate(sizeof(Cons *) * capacity * 2);
+      if (!new_cells) {
+        if (cells != buffer) {
+          free(cells);
+        }
+        return improper_list_type;
+      }
+      memcpy(new_cells, cells, sizeof(Cons *) * length);
+      if (cells != buffer) {
+        free(cells);
+      }
+      cells = new_cells;
+      capacity *= 2;
+    }
+    cells[length++] = tail.cons;
+    tail = tail.cons->tail;
+  }
+  CType *result = improper_list_type;
+  for (size_t i = length; i > 0; i--) {
+    CType *t = get_cons_type(cells[i - 1], tail);
+    if (!t) {
+      result = improper_list_type;
+      break;
+    }
+    cells[i - 1]->type = t;
+    tail = CONS(cells[i - 1]);
+    result = t;
+  }
+  if (cells != buffer) {
+    free(cells);
+  }
+  return result;
+}
+
 NseVal strip_syntax(NseVal v) {
   if (v.type->internal == INTERNAL_SYNTAX) {
     return strip_syntax(v.syntax->quoted);
@@ -686,18 +810,7 @@ int compare_symbol(NseVal v, const Symbol *symbol) {
 int is_special_form(NseVal v) {
   int result = 0;
   if (v.type == symbol_type) {
-    result |= v.symbol == if_symbol;
-    result |= v.symbol == fn_symbol;
-    result |= v.symbol == let_symbol;
-    result |= v.symbol == match_symbol;
-    result |= v.symbol == try_symbol;
-    result |= v.symbol == loop_symbol;
-    result |= v.symbol == continue_symbol;
-    result |= v.symbol == def_symbol;
-    result |= v.symbol == def_macro_symbol;
-    result |= v.symbol == def_read_macro_symbol;
-    result |= v.symbol == def_type_symbol;
-    result |= v.symbol == def_data_symbol;
+    result = v.symbol->special != SPECIAL_NONE;
   } else if (v.type->internal == INTERNAL_SYNTAX) {
     result = is_special_form(v.syntax->quoted);
   }
@@ -717,6 +830,38 @@ size_t list_length(NseVal value) {
   return count;
 }
 
+NseVal slice_pop(Slice *slice) {
+  if (slice->length == 0) {
+    if (!is_cons(slice->rest)) {
+      return undefined;
+    }
+    NseVal value = head(slice->rest);
+    slice->rest = tail(slice->rest);
+    return value;
+  }
+  NseVal value = slice->cells[0];
+  slice->cells++;
+  slice->length--;
+  return value;
+}
+
+int slice_is_empty(Slice slice) {
+  return slice.length == 0 && is_nil(slice.rest);
+}
+
+NseVal slice_to_list(Slice slice) {
+  NseVal list = add_ref(slice.rest);
+  for (size_t i = slice.length; i > 0; i--) {
+    NseVal cons = check_alloc(CONS(create_cons(slice.cells[i - 1], list)));
+    del_ref(list);
+    if (!RESULT_OK(cons)) {
+      return undefined;
+    }
+    list = cons;
+  }
+  return list;
+}
+
 int list_builder_append(NseVal elem, ListBuilder *lb) {
   if (lb->copied) {
     // TODO: modifying last cons is no longer allowed... copy list before
@@ -742,7 +887,7 @@ int list_builder_prepend(NseVal elem, ListBuilder *lb) {
     if (!c) {
       return 0;
     }
-    lb->first->refs--;
+    lb->first->header.refs--;
     lb->first = c;
   } else {
     Cons *c = create_cons(elem, nil);
@@ -759,96 +904,266 @@ NseVal list_builder_finalize(ListBuilder *lb) {
     return nil;
   }
   lb->copied = 1;
-  lb->first->refs++;
+  lb->first->header.refs++;
   return CONS(lb->first);
 }
 
-static int stack_trace_push(NseVal func, NseVal args) {
-  if (!error_form) {
-    return 1;
-  }
-  Cons *c1 = create_cons(SYNTAX(error_form), nil);
-  if (!c1) {
-    return 0;
-  }
-  Cons *c2 = create_cons(args, CONS(c1));
-  del_ref(CONS(c1));
-  if (!c2) {
-    return 0;
+static int stack_trace_push(NseVal func, Slice args) {
+  if (stack_trace_top > call_stack_size) {
+    clear_stack_trace();
   }
-  Cons *c3 = create_cons(func, CONS(c2));
-  del_ref(CONS(c2));
-  if (!c3) {
-    return 0;
-  }
-  NseVal old = stack_trace;
-  Cons *new_trace = create_cons(CONS(c3), old);
-  del_ref(CONS(c3));
-  if (!new_trace) {
-    return 0;
+  if (call_stack_size >= call_stack_capacity) {
+    size_t capacity = call_stack_capacity ? call_stack_capacity * 2 : CALL_STACK_INITIAL_SIZE;
+    CallFrame *stack = realloc(call_stack, sizeof(CallFrame) * capacity);
+    if (!stack) {
+      raise_error(out_of_memory_error, "could not allocate %zd bytes of memory", sizeof(CallFrame) * capacity);
+      return 0;
+    }
+    call_stack = stack;
+    call_stack_capacity = capacity;
   }
-  stack_trace = CONS(new_trace);
-  del_ref(old);
+  call_stack[call_stack_size++] = (CallFrame){ .func = func, .args = args, .form = current_form };
   return 1;
 }
 
 static void stack_trace_pop() {
-  NseVal current = stack_trace;
-  stack_trace = add_ref(tail(current));
-  del_ref(current);
+  if (stack_trace_top > call_stack_size) {
+    // An error was handled within the application
+    clear_stack_trace();
+  }
+  call_stack_size--;
+}
+
+/* Pops a frame whose application failed and adds it to the stack trace. */
+static void stack_trace_fail() {
+  if (stack_trace_top < call_stack_size) {
+    stack_trace_top = call_stack_size;
+  }
+  CallFrame *frame = &call_stack[call_stack_size - 1];
+  frame->arg_list = nil;
+  if (frame->form) {
+    add_ref(frame->func);
+    add_ref(SYNTAX(frame->form));
+    NseVal arg_list = slice_to_list(frame->args);
+    if (RESULT_OK(arg_list)) {
+      frame->arg_list = arg_list;
+    }
+  }
+  call_stack_size--;
 }
 
 NseVal get_stack_trace() {
-  return add_ref(stack_trace);
+  NseVal trace = nil;
+  for (size_t i = call_stack_size; i < stack_trace_top; i++) {
+    CallFrame *frame = &call_stack[i];
+    if (!frame->form) {
+      continue;
+    }
+    NseVal entry = check_alloc(CONS(create_cons(SYNTAX(frame->form), nil)));
+    if (RESULT_OK(entry)) {
+      NseVal tail = entry;
+      entry = check_alloc(CONS(create_cons(frame->arg_list, tail)));
+      del_ref(tail);
+    }
+    if (RESULT_OK(entry)) {
+      NseVal tail = entry;
+      entry = check_alloc(CONS(create_cons(frame->func, tail)));
+      del_ref(tail);
+    }
+    if (!RESULT_OK(entry)) {
+      break;
+    }
+    NseVal next = check_alloc(CONS(create_cons(entry, trace)));
+    del_ref(entry);
+    if (!RESULT_OK(next)) {
+      break;
+    }
+    del_ref(trace);
+    trace = next;
+  }
+  return trace;
 }
 
 void clear_stack_trace() {
-  del_ref(stack_trace);
-  stack_trace = nil;
+  for (size_t i = call_stack_size; i < stack_trace_top; i++) {
+    CallFrame *frame = &call_stack[i];
+    if (frame->form) {
+      del_ref(frame->func);
+      del_ref(SYNTAX(frame->form));
+      del_ref(frame->arg_list);
+    }
+  }
+  stack_trace_top = 0;
+}
+
+#define DISPATCH_CACHE_SIZE 4
+#define DISPATCH_BUFFER_SIZE 8
+
+/* A small cache of the methods selected for the argument types of recent
+ * applications of a generic function. Methods and types are owned by the
+ * dispatch table of the context module, so the entries are only valid as long
+ * as `version` is equal to the method version of the module. */
+struct Dispatch {
+  unsigned int version;
+  /* Number of valid entries. */
+  size_t size;
+  /* Entry to replace on the next miss. */
+  size_t next;
+  NseVal methods[DISPATCH_CACHE_SIZE];
+  /* Parameter types of each entry, `arity` types per entry. */
+  size_t arity;
+  CType *types[];
+};
+
+static Dispatch *get_dispatch(GFunc *func, size_t arity) {
+  Dispatch *dispatch = func->dispatch;
+  if (!dispatch) {
+    dispatch = allocate(sizeof(Dispatch) + sizeof(CType *) * arity * DISPATCH_CACHE_SIZE);
+    if (!dispatch) {
+      return NULL;
+    }
+    dispatch->size = 0;
+    dispatch->next = 0;
+    dispatch->arity = arity;
+    func->dispatch = dispatch;
+  }
+  unsigned int version = module_method_version(func->context);
+  if (dispatch->size && dispatch->version != version) {
+    // The methods of the old entries may have been deleted
+    for (size_t i = 0; i < dispatch->size; i++) {
+      dispatch->methods[i] = undefined;
+    }
+    dispatch->size = 0;
+    dispatch->next = 0;
+  }
+  dispatch->version = version;
+  return dispatch;
+}
+
+static NseVal dispatch_lookup(Dispatch *dispatch, CType **types) {
+  for (size_t i = 0; i < dispatch->size; i++) {
+    CType **entry = dispatch->types + i * dispatch->arity;
+    size_t j = 0;
+    while (j < dispatch->arity && entry[j] == types[j]) {
+      j++;
+    }
+    if (j == dispatch->arity) {
+      return dispatch->methods[i];
+    }
+  }
+  return undefined;
 }
 
-static NseVal apply_generic(GFunc *func, NseVal args) {
+static void dispatch_add(Dispatch *dispatch, CType **types, NseVal method) {
+  size_t i = dispatch->next;
+  dispatch->next = (i + 1) % DISPATCH_CACHE_SIZE;
+  if (dispatch->size <= i) {
+    dispatch->size = i + 1;
+  }
+  memcpy(dispatch->types + i * dispatch->arity, types, sizeof(CType *) * dispatch->arity);
+  dispatch->methods[i] = method;
+}
+
+static NseVal apply_generic(GFunc *func, Slice args) {
   if (!func->context) {
     raise_error(name_error, "generic function has no methods in the current module");
     return undefined;
   }
-  CTypeArray *types = create_type_array_null(func->type->func.min_arity + func->type->func.variadic);
-  NseVal current = args;
-  for (int i = 0; i < func->type->func.min_arity; i++) {
-    if (!is_cons(current)) {
-      char *function_name = nse_write_to_string(SYMBOL(func->name), func->context);
-      raise_error(domain_error, "not enough parameters for generic function %s, expected at least %d", function_name, func->type->func.min_arity);
-      free(function_name);
-      free(types);
+  int min_arity = func->type->func.min_arity;
+  if (args.length < min_arity) {
+    char *function_name = nse_write_to_string(SYMBOL(func->name), func->context);
+    raise_error(domain_error, "not enough parameters for generic function %s, expected at least %d", function_name, min_arity);
+    free(function_name);
+    return undefined;
+  }
+  size_t arity = min_arity + func->type->func.variadic;
+  CType *buffer[DISPATCH_BUFFER_SIZE];
+  CType **types = buffer;
+  if (arity > DISPATCH_BUFFER_SIZE) {
+    types = allocate(sizeof(CType *) * arity);
+    if (!types) {
       return undefined;
     }
-    types->elements[i] = head(current).type;
-    current = tail(current);
+  }
+  for (int i = 0; i < min_arity; i++) {
+    types[i] = get_type(args.cells[i]);
   }
   if (func->type->func.variadic) {
-    if (current.type->type == C_TYPE_INSTANCE && current.type->instance.type == list_type) {
-      types->elements[types->size - 1] = current.type->instance.parameters->elements[0];
-    } else if (!is_nil(current)) {
-      free(types);
-      raise_error(domain_error, "parameter list must be a proper list");
-      return undefined;
-    } else {
-      types->elements[types->size - 1] = any_type;
+    // The element type of the remaining arguments as a list
+    const CType *rest = any_type;
+    if (args.length > min_arity) {
+      rest = get_type(args.cells[args.length - 1]);
+      for (size_t i = args.length - 1; i > min_arity; i--) {
+        rest = unify_types(get_type(args.cells[i - 1]), rest);
+      }
     }
+    types[arity - 1] = (CType *)rest;
+  }
+  NseVal method = undefined;
+  Dispatch *dispatch = get_dispatch(func, arity);
+  if (dispatch) {
+    method = dispatch_lookup(dispatch, types);
   }
-  NseVal method = module_find_method(func->context, func->name, types);
   if (!RESULT_OK(method)) {
+    CTypeArray *parameters = create_type_array_null(arity);
+    if (parameters) {
+      memcpy(parameters->elements, types, sizeof(CType *) * arity);
+      method = module_find_method(func->context, func->name, parameters);
+      free(parameters);
+      if (RESULT_OK(method) && dispatch) {
+        dispatch_add(dispatch, types, method);
+      } else if (!RESULT_OK(method)) {
+        raise_error(name_error, "no method matching types found");
+      }
+    }
+  }
+  if (types != buffer) {
     free(types);
-    raise_error(name_error, "no method matching types found");
+  }
+  if (!RESULT_OK(method)) {
     return undefined;
   }
-  free(types);
-  return nse_apply(method, args);
+  return nse_call(method, args);
 }
 
-NseVal nse_apply(NseVal func, NseVal args) {
+NseVal nse_call(NseVal func, Slice args) {
+  if (!is_nil(args.rest) && (func.type->internal != INTERNAL_CLOSURE || func.closure->f != eval_anon)) {
+    // Only lambdas accept a rest list, other functions expect all arguments in
+    // `cells`
+    size_t length = args.length;
+    NseVal rest = args.rest;
+    for (; is_cons(rest); rest = tail(rest)) {
+      length++;
+    }
+    if (!is_nil(rest)) {
+      set_debug_form(args.rest);
+      raise_error(domain_error, "parameter list must be a proper list");
+      return undefined;
+    }
+    NseVal buffer[8];
+    NseVal *cells = buffer;
+    if (length > 8) {
+      cells = allocate(sizeof(NseVal) * length);
+      if (!cells) {
+        return undefined;
+      }
+    }
+    if (args.length) {
+      // `nse_apply()` passes no cells at all
+      memcpy(cells, args.cells, sizeof(NseVal) * args.length);
+    }
+    rest = args.rest;
+    for (size_t i = args.length; i < length; i++) {
+      cells[i] = head(rest);
+      rest = tail(rest);
+    }
+    NseVal result = nse_call(func, SLICE(cells, length));
+    if (cells != buffer) {
+      free(cells);
+    }
+    return result;
+  }
   NseVal result = undefined;
-  Syntax *old_error_form = error_form;
   if (func.type->internal == INTERNAL_FUNC) {
     if (!stack_trace_push(func, args)) {
       return undefined;
@@ -866,15 +1181,25 @@ NseVal nse_apply(NseVal func, NseVal args) {
     result = apply_generic(func.gfunc, args);
   } else {
     raise_error(domain_error, "not a function");
+    return undefined;
   }
   if (RESULT_OK(result)) {
-    if (old_error_form) {
-      stack_trace_pop();
-    }
+    stack_trace_pop();
+  } else {
+    stack_trace_fail();
   }
   return result;
 }
 
+NseVal nse_apply(NseVal func, NseVal args) {
+  if (!is_cons(args) && !is_nil(args)) {
+    set_debug_form(args);
+    raise_error(domain_error, "parameter list must be a proper list");
+    return undefined;
+  }
+  return nse_call(func, SLICE_REST(NULL, 0, args));
+}
+
 NseVal nse_and(NseVal a, NseVal b) {
   if (is_true(a) && is_true(b)) {
     return TRUE;
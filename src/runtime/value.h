@@ -26,23 +26,26 @@
 #define DATA(d) from_data(d)
 
 #define RESULT_OK(value) ((value).type != NULL)
+/* 1 if the value is reference counted through an `Object` header. */
+#define IS_OBJECT(value) ((value).type && (value).type->internal >= INTERNAL_CONS)
 #define THEN(previous, next) ((RESULT_OK(previous)) ? (next) : undefined)
 #define THENP(previous, next) ((previous) ? (next) : NULL)
 
-#define ARG_POP_ANY(name, args) NseVal name = head(args);\
+#define SLICE(c, l) ((Slice) { .cells = (c), .length = (l), .rest = nil })
+#define SLICE_REST(c, l, r) ((Slice) { .cells = (c), .length = (l), .rest = (r) })
+
+#define ARG_POP_ANY(name, args) NseVal name = slice_pop(&(args));\
   if (!RESULT_OK(name)) {\
     raise_error(domain_error, "too few parameters for function");\
     return undefined;\
-  }\
-  args = tail(args);
+  }
 #define ARG_POP_I64(name, args) int64_t name;\
   {\
-    NseVal temp1 = head(args);\
+    NseVal temp1 = slice_pop(&(args));\
     if (!RESULT_OK(temp1)) {\
       raise_error(domain_error, "too few parameters for function");\
       return undefined;\
     }\
-    args = tail(args);\
     if (!is_i64(temp1)) {\
       char *temp2 = nse_write_to_string(temp1, lang_module);\
       raise_error(domain_error, "%s is not an integer", temp2);\
@@ -53,12 +56,11 @@
   }
 #define ARG_POP_TYPE(type, name, args, convert, type_name) type name;\
   {\
-    NseVal temp1 = head(args);\
+    NseVal temp1 = slice_pop(&(args));\
     if (!RESULT_OK(temp1)) {\
       raise_error(domain_error, "too few parameters for function");\
       return undefined;\
     }\
-    args = tail(args);\
     name = convert(temp1);\
     if (name == NULL) {\
       char *temp2 = nse_write_to_string(temp1, lang_module);\
@@ -69,12 +71,11 @@
   }
 #define ARG_POP_REF(ptr_type, name, args, nse_type) ptr_type name;\
   {\
-    NseVal temp1 = head(args);\
+    NseVal temp1 = slice_pop(&(args));\
     if (!RESULT_OK(temp1)) {\
       raise_error(domain_error, "too few parameters for function");\
       return undefined;\
     }\
-    args = tail(args);\
     if (temp1.type != nse_type) {\
       char *temp2 = nse_write_to_string(temp1, lang_module);\
       char *temp3 = nse_write_to_string(TYPE(nse_type), lang_module);\
@@ -85,16 +86,19 @@
     }\
     name = (ptr_type)temp1.reference->pointer;\
   }
-#define ARG_DONE(args) if (!is_nil(args)) {\
+#define ARG_DONE(args) if (!slice_is_empty(args)) {\
   raise_error(domain_error, "too many parameters for function");\
   return undefined;\
 }
 
 typedef struct NseVal NseVal;
+typedef struct Slice Slice;
+typedef struct Object Object;
 typedef struct Cons Cons;
 typedef struct ListBuilder ListBuilder;
 typedef struct Closure Closure;
 typedef struct GFunc GFunc;
+typedef struct Dispatch Dispatch;
 typedef struct Quote Quote;
 typedef struct Quote TypeQuote;
 typedef struct Quote Continue;
@@ -106,6 +110,27 @@ typedef struct Data Data;
 
 typedef void (* Destructor)(void *);
 
+/* Special forms recognized by the compiler, see `compile_cons()`. */
+typedef enum {
+  SPECIAL_NONE,
+  SPECIAL_IF,
+  SPECIAL_LET,
+  SPECIAL_MATCH,
+  SPECIAL_DO,
+  SPECIAL_FN,
+  SPECIAL_TRY,
+  SPECIAL_CONTINUE,
+  SPECIAL_RECUR,
+  SPECIAL_DEF,
+  SPECIAL_DEF_READ_MACRO,
+  SPECIAL_DEF_TYPE,
+  SPECIAL_DEF_DATA,
+  SPECIAL_DEF_MACRO,
+  SPECIAL_DEF_GENERIC,
+  SPECIAL_DEF_METHOD,
+  SPECIAL_LOOP,
+} SpecialForm;
+
 #include "../module.h"
 #include "../lang.h"
 
@@ -120,32 +145,52 @@ struct NseVal {
     Quote *quote;
     Symbol *symbol;
     String *string;
-    NseVal (*func)(NseVal);
+    NseVal (*func)(Slice);
     CType *type_val;
     Closure *closure;
     GFunc *gfunc;
     Reference *reference;
     Data *data;
+    /* The header of a value whose internal type is an object type, see
+     * `IS_OBJECT()`. */
+    Object *object;
   };
 };
 
-struct Cons {
+/* A borrowed array of values, used for passing arguments to functions. The
+ * values in `cells` are followed by the elements of the list `rest`, which
+ * lets a dotted call or `apply` pass its tail on without copying it. Only
+ * lambdas receive a non-empty rest, see `nse_call()`. */
+struct Slice {
+  NseVal *cells;
+  size_t length;
+  NseVal rest;
+};
+
+/* The header that every reference counted value starts with. */
+struct Object {
+  /* Number of references or IMMORTAL_REFS. */
   size_t refs;
+};
+
+struct Cons {
+  Object header;
+  /* The precise type of the list, NULL until computed by `get_type()`. */
   CType *type;
   NseVal head;
   NseVal tail;
 };
 
 struct ListBuilder {
-  size_t refs;
+  Object header;
   Cons *first;
   Cons *last;
   int copied;
 };
 
 struct Closure {
-  size_t refs;
-  NseVal (*f)(NseVal, NseVal[]);
+  Object header;
+  NseVal (*f)(Slice, NseVal[]);
   String *doc;
   CType *type;
   size_t env_size;
@@ -153,33 +198,41 @@ struct Closure {
 };
 
 struct GFunc {
-  size_t refs;
+  Object header;
   Symbol *name;
   String *doc;
   CType *type;
   Module *context;
+  /* Methods recently selected by `apply_generic()`, NULL until the function
+   * is first applied. */
+  Dispatch *dispatch;
+  /* Copies of a generic function without context bound to modules, see
+   * `bind_gfunc()`. */
+  GFunc *bound;
+  /* Next copy bound to a module. */
+  GFunc *next_bound;
 };
 
 struct Quote {
-  size_t refs;
+  Object header;
   NseVal quoted;
 };
 
 struct String {
-  size_t refs;
+  Object header;
   size_t length;
   char chars[];
 };
 
 struct Reference {
-  size_t refs;
+  Object header;
   CType *type;
   void *pointer;
   Destructor destructor;
 };
 
 struct Syntax {
-  size_t refs;
+  Object header;
   size_t start_line;
   size_t start_column;
   size_t end_line;
@@ -189,13 +242,19 @@ struct Syntax {
 };
 
 struct Symbol {
-  size_t refs;
+  Object header;
   Module *module;
+  /* The special form named by the symbol, if any. */
+  SpecialForm special;
+  /* Number of times a macro has been defined for the symbol, 0 if the symbol
+   * does not name a macro. Lets ordinary calls skip the macro lookup and
+   * invalidates cached macro expansions. */
+  unsigned int macro;
   char name[];
 };
 
 struct Data {
-  size_t refs;
+  Object header;
   CType *type;
   Symbol *tag;
   size_t record_size;
@@ -216,8 +275,12 @@ Syntax *create_syntax(NseVal quoted);
 Symbol *create_symbol(const char *s, Module *module);
 Symbol *create_keyword(const char *s, Module *module);
 String *create_string(const char *s, size_t length);
-Closure *create_closure(NseVal f(NseVal, NseVal[]), CType *type, NseVal env[], size_t env_size);
+Closure *create_closure(NseVal f(Slice, NseVal[]), CType *type, NseVal env[], size_t env_size);
 GFunc *create_gfunc(Symbol *name, CType *type, Module *context);
+/* Returns a borrowed copy of the generic function `g` bound to `context`. The
+ * copy is created on the first call and owned by `g`. Returns NULL if
+ * allocation fails. */
+GFunc *bind_gfunc(GFunc *g, Module *context);
 Reference *create_reference(CType *type, void *pointer, void destructor(void *));
 void void_destructor(void * p);
 Data *create_data(CType *type, Symbol *tag, NseVal record[], size_t record_size);
@@ -233,6 +296,10 @@ NseVal from_data(Data *d);
 
 NseVal strip_syntax(NseVal v);
 
+/* Returns the precise type of a value (borrowed). Lists are typed as
+ * `improper-list` when created, their element type is computed on demand. */
+CType *get_type(NseVal v);
+
 Cons *to_cons(NseVal v);
 Symbol *to_symbol(NseVal v);
 String *to_string(NseVal v);
@@ -241,21 +308,42 @@ const char *to_string_constant(NseVal v);
 void *to_reference(NseVal v);
 CType *to_type(NseVal v);
 
+/* The form that is currently being evaluated or compiled. The form is borrowed
+ * from the code or syntax that is being processed. */
+extern Syntax *current_form;
+/* The form that caused the current error. */
 extern Syntax *error_form;
+/* Sets the form that caused the error that is about to be raised. */
 void set_debug_form(NseVal form);
+/* Called by `raise_error()` to record the location of an error: the form given
+ * to `set_debug_form()`, or otherwise the current form. */
+void record_error_form();
 Syntax *push_debug_form(Syntax *syntax);
 NseVal pop_debug_form(NseVal result, Syntax *previous);
 NseVal get_stack_trace();
 void clear_stack_trace();
 
 NseVal add_ref(NseVal p);
+/* Decrements the reference count of a value and deletes it if the count
+ * reaches zero. Values referenced only by a deleted value are queued and
+ * deleted incrementally by later calls. */
 void del_ref(NseVal p);
+/* Deletes all values in the deletion queue of `del_ref()`. */
+void flush_deleted();
 
 NseVal head(NseVal cons);
 NseVal tail(NseVal cons);
 NseVal elem(size_t n, NseVal cons);
 size_t list_length(NseVal list);
 
+/* Removes and returns the first element of a slice, or returns undefined if
+ * the slice is empty. Does not raise an error. */
+NseVal slice_pop(Slice *slice);
+int slice_is_empty(Slice slice);
+/* Creates a list of the elements of a slice. The rest of the slice is shared
+ * by the list. */
+NseVal slice_to_list(Slice slice);
+
 int list_builder_append(NseVal elem, ListBuilder *lb);
 int list_builder_prepend(NseVal elem, ListBuilder *lb);
 NseVal list_builder_finalize(ListBuilder *lb);
@@ -263,6 +351,7 @@ NseVal list_builder_finalize(ListBuilder *lb);
 int is_cons(NseVal v);
 int is_nil(NseVal v);
 int is_list(NseVal v);
+int is_proper_list(NseVal v);
 int is_i64(NseVal v);
 int is_f64(NseVal v);
 int is_quote(NseVal v);
@@ -279,7 +368,10 @@ int is_data(NseVal b);
 int compare_symbol(NseVal v, const Symbol *sym);
 int is_special_form(NseVal v);
 
+/* Applies a function to a list of arguments. */
 NseVal nse_apply(NseVal func, NseVal args);
+/* Applies a function to an array of arguments. */
+NseVal nse_call(NseVal func, Slice args);
 NseVal nse_and(NseVal a, NseVal b);
 NseVal nse_equals(NseVal a, NseVal b);
 
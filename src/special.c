@@ -1,289 +1,659 @@
 #include <string.h>
 
 #include "eval.h"
+#include "compile.h"
 #include "write.h"
 #include "runtime/error.h"
 #include "runtime/validate.h"
+#include "runtime/cycle.h"
 
 #include "special.h"
 
-NseVal eval_if(NseVal args, Scope *scope) {
-  NseVal result = undefined;
+/* (if EXPR EXPR EXPR) */
+Code *compile_if(NseVal args, Compiler *c) {
   NseVal condition = head(args);
   NseVal consequent = THEN(condition, elem(1, args));
   NseVal alternative = THEN(consequent, elem(2, args));
-  NseVal condition_result = THEN(alternative, eval(condition, scope));
-  if (RESULT_OK(condition_result)) {
-    if (is_true(condition_result)) {
-      result = eval(consequent, scope);
-    } else {
-      result = eval(alternative, scope);
-    }
-    del_ref(condition_result);
+  if (!RESULT_OK(alternative)) {
+    return NULL;
   }
-  return result;
+  Code *code = create_code(CODE_IF, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->if_.condition = compile(condition, c);
+  code->if_.consequent = THENP(code->if_.condition, compile(consequent, c));
+  code->if_.alternative = THENP(code->if_.consequent, compile(alternative, c));
+  if (!code->if_.alternative) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
 }
 
-NseVal eval_let(NseVal args, Scope *scope) {
-  Scope *let_scope = scope;
-  NseVal result = undefined;
+/* (let ({(PATTERN EXPR)}) {STMT})
+ * The variables of a let-form are visible in the values of the let-form. A
+ * variable that is referenced before it has been assigned (e.g. by a
+ * recursive function) is stored in a box, which is assigned once the value
+ * has been computed. A function whose only references to itself are
+ * self-calls in tail position is a loop and needs no box, so it doesn't form a
+ * cycle with one. */
+Code *compile_let(NseVal args, Compiler *c) {
   NseVal defs = head(args);
   NseVal body = THEN(defs, tail(args));
-  if (RESULT_OK(body)) {
-    int ok = 1;
-    while (is_cons(defs)) {
-      NseVal pattern = head(head(defs));
-      if (!RESULT_OK(pattern)) {
-        ok = 0;
-        break;
-      }
-      Symbol *symbol = to_symbol(pattern);
-      if (symbol) {
-        let_scope = scope_push(let_scope, symbol, undefined);
-      }
-      defs = tail(defs);
+  if (!RESULT_OK(body)) {
+    return NULL;
+  }
+  Code *code = create_code(CODE_LET, undefined);
+  if (!code) {
+    return NULL;
+  }
+  size_t size = 0;
+  for (NseVal def = defs; is_cons(def); def = tail(def)) {
+    size++;
+  }
+  if (size > 0) {
+    code->let.patterns = allocate(sizeof(Pattern *) * size);
+    code->let.slots = allocate(sizeof(size_t) * size);
+    code->let.boxes = allocate(sizeof(int) * size);
+    code->let.values = create_code_array(size);
+    if (!code->let.patterns || !code->let.slots || !code->let.boxes || !code->let.values) {
+      delete_code(code);
+      return NULL;
     }
-    defs = head(args);
-    while (is_cons(defs)) {
-      NseVal pattern = head(head(defs));
-      if (!RESULT_OK(pattern)) {
-        ok = 0;
-        break;
-      }
-      NseVal assignment = eval(elem(1, head(defs)), let_scope);
-      if (!RESULT_OK(assignment)) {
-        ok = 0;
-        break;
+    memset(code->let.patterns, 0, sizeof(Pattern *) * size);
+    memset(code->let.boxes, 0, sizeof(int) * size);
+    code->let.size = size;
+  }
+  LexScope *start = c->scope;
+  NseVal def = defs;
+  for (size_t i = 0; i < size; i++) {
+    NseVal pattern = head(head(def));
+    NseVal value = THEN(pattern, elem(1, head(def)));
+    if (!RESULT_OK(value)) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
+    }
+    Symbol *name = to_symbol(pattern);
+    if (name) {
+      LexScope *box = compile_push(c, LEX_BOX, name);
+      if (!box) {
+        compile_pop_until(c, start);
+        delete_code(code);
+        return NULL;
       }
-      if (assignment.type->internal == INTERNAL_CLOSURE && is_symbol(pattern)) {
-        assignment.closure = optimize_tail_call(assignment.closure, to_symbol(pattern));
-        if (!assignment.closure) {
-          del_ref(assignment);
-          ok = 0;
-          break;
+      code->let.slots[i] = box->size - 1;
+      code->let.boxes[i] = -1;
+    }
+    def = tail(def);
+  }
+  def = defs;
+  for (size_t i = 0; i < size; i++) {
+    NseVal pattern = head(head(def));
+    code->let.values[i] = compile(elem(1, head(def)), c);
+    if (!code->let.values[i]) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
+    }
+    Symbol *name = to_symbol(pattern);
+    if (name && code->let.values[i]->type == CODE_FN) {
+      size_t continues = optimize_tail_call(code->let.values[i]->fn.lambda.reference->pointer, name);
+      // Self-calls replaced by continue-forms no longer refer to the variable,
+      // so a function that only calls itself that way needs no box
+      for (LexScope *scope = c->scope; scope != start; scope = scope->next) {
+        if (scope->type == LEX_BOX && scope->size - 1 == code->let.slots[i]) {
+          scope->uses -= continues;
         }
       }
-      Symbol *symbol = to_symbol(pattern);
-      if (symbol) {
-        scope_set(let_scope, symbol, assignment, 1);
-      }
-      if (!match_pattern(&let_scope, pattern, assignment)) {
-        ok = 0;
-      }
-      del_ref(assignment);
-      defs = tail(defs);
     }
-    if (ok) {
-      result = eval_block(body, let_scope);
+    code->let.patterns[i] = compile_pattern(pattern, c);
+    if (!code->let.patterns[i]) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
     }
-    scope_pop_until(let_scope, scope);
+    def = tail(def);
   }
-  return result;
+  for (LexScope *scope = c->scope; scope != start; scope = scope->next) {
+    if (scope->type == LEX_BOX && scope->uses > 0) {
+      for (size_t i = 0; i < size; i++) {
+        if (code->let.boxes[i] && code->let.slots[i] == scope->size - 1) {
+          code->let.boxes[i] = 1;
+        }
+      }
+    }
+  }
+  code->let.body = compile_block(body, c);
+  compile_pop_until(c, start);
+  if (!code->let.body) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
 }
 
-NseVal eval_match(NseVal args, Scope *scope) {
-  NseVal result = undefined;
-  NseVal h = head(args);
-  NseVal value = THEN(h, eval(h, scope));
-  if (RESULT_OK(value)) {
-    NseVal cases = tail(args);
-    if (is_cons(cases)) {
-      for (; is_cons(cases); cases = tail(cases)) {
-        NseVal c = head(cases);
-        if (!is_cons(c)) {
-          raise_error(syntax_error, "match case must be a list");
-          break;
-        }
-        Scope *case_scope = scope;
-        if (match_pattern(&case_scope, head(c), value)) {
-          result = eval_block(tail(c), case_scope);
-          scope_pop_until(case_scope, scope);
-          break;
-        }
-        scope_pop_until(case_scope, scope);
+int exec_let_bindings(Code *code, Frame *frame) {
+  for (size_t i = 0; i < code->let.size; i++) {
+    if (code->let.boxes[i] > 0) {
+      NseVal box_ref = create_box();
+      if (!RESULT_OK(box_ref)) {
+        return 0;
       }
+      set_slot(frame, code->let.slots[i], box_ref);
+      del_ref(box_ref);
+    } else if (code->let.boxes[i] < 0) {
+      set_slot(frame, code->let.slots[i], undefined);
     }
-    del_ref(value);
   }
-  return result;
+  for (size_t i = 0; i < code->let.size; i++) {
+    NseVal assignment = exec(code->let.values[i], frame);
+    if (!RESULT_OK(assignment)) {
+      return 0;
+    }
+    if (code->let.boxes[i] > 0) {
+      set_box(frame->slots[code->let.slots[i]], assignment);
+    }
+    int ok = match_pattern(code->let.patterns[i], assignment, frame);
+    del_ref(assignment);
+    if (!ok) {
+      return 0;
+    }
+  }
+  return 1;
 }
 
-NseVal eval_fn(NseVal args, Scope *scope) {
-  Scope *fn_scope = copy_scope(scope);
-  NseVal result = undefined;
-  NseVal scope_ref = check_alloc(REFERENCE(create_reference(copy_type(scope_type), fn_scope, (Destructor) delete_scope)));
-  if (RESULT_OK(scope_ref)) {
-    NseVal env[] = {args, scope_ref};
-    CType *func_type = parameters_to_type(head(args));
-    if (func_type) {
-      result = check_alloc(CLOSURE(create_closure(eval_anon, func_type, env, 2)));
+/* Returns the constructor tag tested by a pattern, or NULL if the pattern does
+ * not test a tag. */
+static Symbol *pattern_tag(Pattern *pattern) {
+  if (pattern->type == PATTERN_CONS) {
+    pattern = pattern->cons.head;
+  }
+  if (pattern->type == PATTERN_QUOTE) {
+    return pattern->literal.tag;
+  }
+  return NULL;
+}
+
+/* Collects the cases of a match-form that can match data with the given tag
+ * into a branch. A case that binds the whole value matches any tag, and other
+ * cases never match data. */
+static int compile_match_branch(Code *code, Symbol *tag, MatchBranch *branch) {
+  branch->size = 0;
+  branch->cases = allocate(sizeof(size_t) * code->match.size);
+  if (!branch->cases) {
+    return 0;
+  }
+  for (size_t i = 0; i < code->match.size; i++) {
+    Pattern *pattern = code->match.patterns[i];
+    if (pattern->type == PATTERN_BIND || (tag && pattern_tag(pattern) == tag)) {
+      branch->cases[branch->size++] = i;
     }
-    del_ref(scope_ref);
-  } else {
-    delete_scope(fn_scope);
   }
-  return result;
+  return 1;
 }
 
-NseVal eval_try(NseVal args, Scope *scope) {
-  NseVal h = head(args);
-  if (RESULT_OK(h)) {
-    NseVal result = eval(h, scope);
-    if (RESULT_OK(result)) {
-      NseVal tag = check_alloc(SYMBOL(intern_special("ok")));
-      NseVal tail = check_alloc(CONS(create_cons(result, nil)));
-      del_ref(result);
-      NseVal output = check_alloc(CONS(create_cons(tag, tail))); 
-      del_ref(tag);
-      del_ref(tail);
-      return output;
-    } else {
-      NseVal tag = add_ref(SYMBOL(current_error_type()));
-      NseVal msg = check_alloc(STRING(create_string(current_error(), strlen(current_error()))));
-      NseVal form = check_alloc(SYNTAX(error_form));
-      NseVal tail1 = check_alloc(CONS(create_cons(get_stack_trace(), nil)));
-      NseVal tail2 = check_alloc(CONS(create_cons(form, tail1)));
-      NseVal tail3 = check_alloc(CONS(create_cons(msg, tail2)));
-      del_ref(msg);
-      del_ref(tail1);
-      del_ref(tail2);
-      NseVal output = check_alloc(CONS(create_cons(tag, tail3))); 
-      del_ref(tag);
-      del_ref(tail3);
-      return output;
+/* Indexes the cases of a match-form by the constructor tags they test, so that
+ * a data value is only tested against the cases that can match its tag. */
+static int compile_match_branches(Code *code) {
+  for (size_t i = 0; i < code->match.size; i++) {
+    Symbol *tag = pattern_tag(code->match.patterns[i]);
+    if (!tag) {
+      continue;
+    }
+    if (!HASH_MAP_INITIALIZED(code->match.branches)) {
+      code->match.branches = create_branch_map();
+      if (!compile_match_branch(code, NULL, &code->match.other_tags)) {
+        return 0;
+      }
+    }
+    if (branch_map_lookup(code->match.branches, tag)) {
+      continue;
+    }
+    MatchBranch *branch = allocate(sizeof(MatchBranch));
+    if (!branch) {
+      return 0;
+    }
+    if (!compile_match_branch(code, tag, branch) || !branch_map_add(code->match.branches, tag, branch)) {
+      free(branch->cases);
+      free(branch);
+      return 0;
     }
   }
-  return undefined;
+  return 1;
 }
 
-NseVal eval_continue(NseVal args, Scope *scope) {
-  NseVal result = undefined;
-  NseVal arg_list = eval_list(args, scope);
-  if (RESULT_OK(arg_list)) {
-    result = check_alloc(CONTINUE(create_continue(arg_list)));
-    del_ref(arg_list);
+/* (match EXPR {(PATTERN {STMT})}) */
+Code *compile_match(NseVal args, Compiler *c) {
+  NseVal h = head(args);
+  if (!RESULT_OK(h)) {
+    return NULL;
   }
-  return result;
+  Code *code = create_code(CODE_MATCH, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->match.value = compile(h, c);
+  if (!code->match.value) {
+    delete_code(code);
+    return NULL;
+  }
+  NseVal cases = tail(args);
+  size_t size = 0;
+  for (NseVal match_case = cases; is_cons(match_case); match_case = tail(match_case)) {
+    size++;
+  }
+  if (size > 0) {
+    code->match.patterns = allocate(sizeof(Pattern *) * size);
+    code->match.bodies = create_code_array(size);
+    if (!code->match.patterns || !code->match.bodies) {
+      delete_code(code);
+      return NULL;
+    }
+    memset(code->match.patterns, 0, sizeof(Pattern *) * size);
+    code->match.size = size;
+  }
+  LexScope *start = c->scope;
+  for (size_t i = 0; i < size; i++) {
+    NseVal match_case = head(cases);
+    if (!is_cons(match_case)) {
+      set_debug_form(match_case);
+      raise_error(syntax_error, "match case must be a list");
+      delete_code(code);
+      return NULL;
+    }
+    code->match.patterns[i] = compile_pattern(head(match_case), c);
+    code->match.bodies[i] = THENP(code->match.patterns[i], compile_block(tail(match_case), c));
+    compile_pop_until(c, start);
+    if (!code->match.bodies[i]) {
+      delete_code(code);
+      return NULL;
+    }
+    cases = tail(cases);
+  }
+  if (!compile_match_branches(code)) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
 }
 
-NseVal eval_recur(NseVal args, Scope *scope) {
-  NseVal pattern = head(args);
-  NseVal body = THEN(pattern, elem(1, args));
-  Scope *loop_scope = scope;
-  if (RESULT_OK(body)) {
-    NseVal result = undefined;
-    while (1) {
-      result = eval(body, loop_scope);
-      if (!RESULT_OK(result) || result.type != continue_type) {
+Code *exec_match_case(Code *code, Frame *frame) {
+  NseVal value = exec(code->match.value, frame);
+  if (!RESULT_OK(value)) {
+    return NULL;
+  }
+  Code *body = NULL;
+  if (HASH_MAP_INITIALIZED(code->match.branches) && value.type->internal == INTERNAL_DATA) {
+    // The tags of the cases in the branch are known to match, so only their
+    // fields are tested
+    MatchBranch *branch = branch_map_lookup(code->match.branches, value.data->tag);
+    if (!branch) {
+      branch = &code->match.other_tags;
+    }
+    for (size_t i = 0; i < branch->size; i++) {
+      Pattern *pattern = code->match.patterns[branch->cases[i]];
+      int match;
+      if (pattern->type == PATTERN_BIND) {
+        set_slot(frame, pattern->slot, value);
+        match = 1;
+      } else {
+        match = try_match_fields(pattern->type == PATTERN_CONS ? pattern->cons.tail : NULL, value.data, frame);
+      }
+      if (match) {
+        body = code->match.bodies[branch->cases[i]];
         break;
       }
-      scope_pop_until(loop_scope, scope);
-      loop_scope = scope;
-      if (!assign_parameters(&loop_scope, pattern, result.quote->quoted)) {
-        del_ref(result);
-        result = undefined;
+    }
+  } else {
+    for (size_t i = 0; i < code->match.size; i++) {
+      if (try_match_pattern(code->match.patterns[i], value, frame)) {
+        body = code->match.bodies[i];
         break;
       }
-      del_ref(result);
     }
-    scope_pop_until(loop_scope, scope);
-    return result;
   }
-  return undefined;
+  if (!body) {
+    raise_error(pattern_error, "pattern match failed");
+  }
+  del_ref(value);
+  return body;
 }
 
-static NseVal eval_def_func(NseVal first, NseVal args, Scope *scope) {
-  NseVal result = undefined;
-  Symbol *symbol = to_symbol(head(first));
-  if (symbol) {
-    Scope *fn_scope = copy_scope(scope);
-    NseVal scope_ref = check_alloc(REFERENCE(create_reference(copy_type(scope_type), fn_scope, (Destructor) delete_scope)));
-    if (RESULT_OK(scope_ref)) {
-      NseVal body = tail(args);
-      NseVal formal = tail(first);
-      if (RESULT_OK(formal) && RESULT_OK(body)) {
-        String *doc_string = NULL;
-        if (is_cons(body) && is_string(head(body))) {
-          doc_string = to_string(head(body));
-          body = tail(body);
-        }
-        NseVal def = check_alloc(CONS(create_cons(formal, body)));
-        if (RESULT_OK(def)) {
-          NseVal env[] = {def, scope_ref};
-          CType *func_type = parameters_to_type(head(def));
-          if (func_type) {
-            NseVal func = check_alloc(CLOSURE(create_closure(eval_anon, func_type, env, 2)));
-            if (RESULT_OK(func)) {
-              func.closure = optimize_tail_call(func.closure, symbol);
-              if (func.closure) {
-                if (doc_string) {
-                  add_ref(STRING(doc_string));
-                  func.closure->doc = doc_string;
-                }
-                module_define(symbol, func);
-                result = add_ref(SYMBOL(symbol));
-              }
-              del_ref(func);
-            }
-          }
-          del_ref(def);
-        }
-      }
-      del_ref(scope_ref);
-    } else {
-      delete_scope(fn_scope);
+static Code *compile_function(CodeType type, Symbol *name, NseVal formal, NseVal body, Compiler *c) {
+  Code *code = create_code(type, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->fn.lambda = undefined;
+  if (name) {
+    code->fn.name = add_ref(SYMBOL(name)).symbol;
+  }
+  code->fn.type = parameters_to_type(formal);
+  if (!code->fn.type) {
+    delete_code(code);
+    return NULL;
+  }
+  code->fn.lambda = compile_lambda(formal, body, c);
+  if (!RESULT_OK(code->fn.lambda)) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
+}
+
+/* The environment of the closure consists of the lambda followed by the
+ * values of its free variables. */
+static NseVal create_function(Code *code, Frame *frame) {
+  Lambda *lambda = code->fn.lambda.reference->pointer;
+  NseVal buffer[16];
+  NseVal *env = buffer;
+  if (lambda->env_size > 16) {
+    env = allocate(sizeof(NseVal) * lambda->env_size);
+    if (!env) {
+      return undefined;
     }
+  }
+  env[0] = code->fn.lambda;
+  for (size_t i = 1; i < lambda->env_size; i++) {
+    Capture *capture = &lambda->captures[i - 1];
+    env[i] = capture->env ? frame->env[capture->index] : frame->slots[capture->index];
+  }
+  NseVal result = check_alloc(CLOSURE(create_closure(eval_anon, copy_type(code->fn.type), env, lambda->env_size)));
+  if (env != buffer) {
+    free(env);
+  }
+  return result;
+}
+
+/* (fn FORMAL {STMT}) */
+Code *compile_fn(NseVal args, Compiler *c) {
+  NseVal formal = head(args);
+  NseVal body = THEN(formal, tail(args));
+  if (!RESULT_OK(body)) {
+    return NULL;
+  }
+  return compile_function(CODE_FN, NULL, formal, body, c);
+}
+
+NseVal exec_fn(Code *code, Frame *frame) {
+  return create_function(code, frame);
+}
+
+/* (try EXPR) */
+Code *compile_try(NseVal args, Compiler *c) {
+  NseVal h = head(args);
+  if (!RESULT_OK(h)) {
+    return NULL;
+  }
+  Code *body = compile(h, c);
+  if (!body) {
+    return NULL;
+  }
+  Code *code = create_code(CODE_TRY, undefined);
+  if (!code) {
+    delete_code(body);
+    return NULL;
+  }
+  code->body = body;
+  return code;
+}
+
+NseVal exec_try(Code *code, Frame *frame) {
+  NseVal result = exec(code->body, frame);
+  if (RESULT_OK(result)) {
+    NseVal tag = check_alloc(SYMBOL(intern_special("ok")));
+    NseVal tail = check_alloc(CONS(create_cons(result, nil)));
+    del_ref(result);
+    NseVal output = check_alloc(CONS(create_cons(tag, tail))); 
+    del_ref(tag);
+    del_ref(tail);
+    return output;
   } else {
+    NseVal tag = add_ref(SYMBOL(current_error_type()));
+    NseVal msg = check_alloc(STRING(create_string(current_error(), strlen(current_error()))));
+    NseVal form = check_alloc(SYNTAX(error_form));
+    NseVal stack_trace = get_stack_trace();
+    NseVal tail1 = check_alloc(CONS(create_cons(stack_trace, nil)));
+    del_ref(stack_trace);
+    clear_stack_trace();
+    NseVal tail2 = check_alloc(CONS(create_cons(form, tail1)));
+    NseVal tail3 = check_alloc(CONS(create_cons(msg, tail2)));
+    del_ref(msg);
+    del_ref(tail1);
+    del_ref(tail2);
+    NseVal output = check_alloc(CONS(create_cons(tag, tail3))); 
+    del_ref(tag);
+    del_ref(tail3);
+    return output;
+  }
+}
+
+/* (continue {EXPR}) */
+Code *compile_continue(NseVal args, Compiler *c) {
+  Code *code = create_code(CODE_CONTINUE, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->call.macro_args = undefined;
+  if (!compile_arguments(code, args, c)) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
+}
+
+/* (recur FORMAL EXPR)
+ * The first iteration of the body is evaluated with the variables of the
+ * enclosing scope, so the parameters are initialized with the values of the
+ * variables with the same names. */
+Code *compile_recur(NseVal args, Compiler *c) {
+  NseVal formal = head(args);
+  NseVal body = THEN(formal, elem(1, args));
+  if (!RESULT_OK(body)) {
+    return NULL;
+  }
+  Code *code = create_code(CODE_RECUR, undefined);
+  if (!code) {
+    return NULL;
+  }
+  LexScope *start = c->scope;
+  if (!compile_parameters(formal, &code->recur.parameters, c)) {
+    compile_pop_until(c, start);
+    delete_code(code);
+    return NULL;
+  }
+  size_t size = 0;
+  for (LexScope *scope = c->scope; scope != start; scope = scope->next) {
+    size++;
+  }
+  if (size > 0) {
+    code->recur.init_slots = allocate(sizeof(size_t) * size);
+    code->recur.inits = create_code_array(size);
+    if (!code->recur.init_slots || !code->recur.inits) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
+    }
+    code->recur.init_size = size;
+  }
+  Compiler outer = *c;
+  outer.scope = start;
+  size_t i = 0;
+  for (LexScope *scope = c->scope; scope != start; scope = scope->next) {
+    code->recur.init_slots[i] = scope->size - 1;
+    code->recur.inits[i] = compile_variable(scope->symbol, &outer);
+    if (!code->recur.inits[i]) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
+    }
+    i++;
+  }
+  code->recur.body = compile(body, c);
+  compile_pop_until(c, start);
+  if (!code->recur.body) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
+}
+
+static Code *compile_def_func(NseVal first, NseVal args, Compiler *c) {
+  Symbol *symbol = to_symbol(head(first));
+  if (!symbol) {
     raise_error(syntax_error, "name of function must be a symbol");
+    return NULL;
   }
-  return result;
+  NseVal body = tail(args);
+  NseVal formal = THEN(body, tail(first));
+  if (!RESULT_OK(formal)) {
+    return NULL;
+  }
+  String *doc_string = NULL;
+  if (is_cons(body) && is_string(head(body))) {
+    doc_string = to_string(head(body));
+    body = tail(body);
+  }
+  Code *code = compile_function(CODE_DEF_FUNC, symbol, formal, body, c);
+  if (code) {
+    optimize_tail_call(code->fn.lambda.reference->pointer, symbol);
+    if (doc_string) {
+      code->fn.doc = add_ref(STRING(doc_string)).string;
+    }
+  }
+  return code;
 }
 
-static NseVal eval_def_var(NseVal first, NseVal args, Scope *scope) {
+static Code *compile_def_var(NseVal first, NseVal args, Compiler *c) {
   Symbol *symbol = to_symbol(first);
-  if (symbol) {
-    NseVal expr = head(tail(args));
-    NseVal value = THEN(expr, eval(expr, scope));
-    if (RESULT_OK(value)) {
-      module_define(symbol, value);
-      del_ref(value);
-      return add_ref(SYMBOL(symbol));
-    }
-  } else {
+  if (!symbol) {
     raise_error(syntax_error, "name of constant must be a symbol");
+    return NULL;
   }
-  return undefined;
+  NseVal expr = head(tail(args));
+  if (!RESULT_OK(expr)) {
+    return NULL;
+  }
+  Code *code = create_code(CODE_DEF_VAR, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->def.name = add_ref(SYMBOL(symbol)).symbol;
+  code->def.value = compile(expr, c);
+  if (!code->def.value) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
 }
 
-NseVal eval_def(NseVal args, Scope *scope) {
+/* (def SYMBOL EXPR) or (def (SYMBOL {FORMAL}) {STMT}) */
+Code *compile_def(NseVal args, Compiler *c) {
   NseVal h = head(args);
-  if (RESULT_OK(h)) {
-    if (is_cons(h)) {
-      return eval_def_func(h, args, scope);
-    } else {
-      return eval_def_var(h, args, scope);
-    }
+  if (!RESULT_OK(h)) {
+    return NULL;
+  }
+  if (is_cons(h)) {
+    return compile_def_func(h, args, c);
   } else {
+    return compile_def_var(h, args, c);
+  }
+}
+
+NseVal exec_def_func(Code *code, Frame *frame) {
+  NseVal func = create_function(code, frame);
+  if (!RESULT_OK(func)) {
     return undefined;
   }
+  if (code->fn.doc) {
+    func.closure->doc = add_ref(STRING(code->fn.doc)).string;
+  }
+  module_define(code->fn.name, func);
+  del_ref(func);
+  return add_ref(SYMBOL(code->fn.name));
 }
 
-NseVal eval_def_read_macro(NseVal args, Scope *scope) {
+NseVal exec_def_var(Code *code, Frame *frame) {
+  NseVal value = exec(code->def.value, frame);
+  if (!RESULT_OK(value)) {
+    return undefined;
+  }
+  module_define(code->def.name, value);
+  del_ref(value);
+  return add_ref(SYMBOL(code->def.name));
+}
+
+/* (def-read-macro SYMBOL EXPR) */
+Code *compile_def_read_macro(NseVal args, Compiler *c) {
   NseVal h = head(args);
-  if (RESULT_OK(h)) {
-    Symbol *symbol = to_symbol(h);
-    if (symbol) {
-      NseVal value = eval(head(tail(args)), scope);
-      if (RESULT_OK(value)) {
-        module_define_read_macro(symbol, value);
-        del_ref(value);
-        return add_ref(SYMBOL(symbol));
-      }
-    } else {
-      raise_error(syntax_error, "name of read macro must be a symbol");
-    }
+  if (!RESULT_OK(h)) {
+    return NULL;
   }
-  return undefined;
+  Symbol *symbol = to_symbol(h);
+  if (!symbol) {
+    raise_error(syntax_error, "name of read macro must be a symbol");
+    return NULL;
+  }
+  NseVal expr = head(tail(args));
+  if (!RESULT_OK(expr)) {
+    return NULL;
+  }
+  Code *code = create_code(CODE_DEF_READ_MACRO, undefined);
+  if (!code) {
+    return NULL;
+  }
+  code->def.name = add_ref(SYMBOL(symbol)).symbol;
+  code->def.value = compile(expr, c);
+  if (!code->def.value) {
+    delete_code(code);
+    return NULL;
+  }
+  return code;
+}
+
+NseVal exec_def_read_macro(Code *code, Frame *frame) {
+  NseVal value = exec(code->def.value, frame);
+  if (!RESULT_OK(value)) {
+    return undefined;
+  }
+  module_define_read_macro(code->def.name, value);
+  del_ref(value);
+  return add_ref(SYMBOL(code->def.name));
+}
+
+/* (def-macro (SYMBOL {FORMAL}) {STMT}) */
+Code *compile_def_macro(NseVal args, Compiler *c) {
+  NseVal h = head(args);
+  if (!RESULT_OK(h)) {
+    return NULL;
+  }
+  if (!is_cons(h)) {
+    raise_error(syntax_error, "macro must be a function");
+    return NULL;
+  }
+  Symbol *symbol = to_symbol(head(h));
+  if (!symbol) {
+    raise_error(syntax_error, "name of macro must be a symbol");
+    return NULL;
+  }
+  NseVal body = tail(args);
+  NseVal formal = THEN(body, tail(h));
+  if (!RESULT_OK(formal)) {
+    return NULL;
+  }
+  return compile_function(CODE_DEF_MACRO, symbol, formal, body, c);
+}
+
+NseVal exec_def_macro(Code *code, Frame *frame) {
+  NseVal value = create_function(code, frame);
+  if (!RESULT_OK(value)) {
+    return undefined;
+  }
+  module_define_macro(code->fn.name, value);
+  del_ref(value);
+  return add_ref(SYMBOL(code->fn.name));
 }
 
 NseVal eval_def_type(NseVal args, Scope *scope) {
@@ -450,13 +820,12 @@ static void raise_parameter_type_error(Symbol *function_name, CType *expected, C
   delete_type(actual);
 }
 
-static NseVal apply_constructor(NseVal args, NseVal env[]) {
+static NseVal apply_constructor(Slice args, NseVal env[]) {
   CType *t = env[0].type_val;
   Symbol *tag = env[1].symbol;
   int arity = env[2].i64;
   NseVal types = env[3];
   Scope *scope = env[4].reference->pointer;
-  NseVal *record = NULL;
   int ok = 1;
   GType *g = NULL;
   CTypeArray *g_params = NULL;
@@ -466,46 +835,42 @@ static NseVal apply_constructor(NseVal args, NseVal env[]) {
     g_arity = generic_type_arity(g);
   }
   if (arity > 0) {
-    record = allocate(sizeof(NseVal) * arity);
-    if (!record) {
-      return undefined;
-    }
     int i = 0;
     while (is_cons(types)) {
-      NseVal arg;
-      if (!accept_elem_any(&args, &arg)) {
+      if (i >= args.length) {
         raise_error(domain_error, "%s expects %d parameters, but got %d", tag->name, arity, i);
         ok = 0;
         break;
       }
+      NseVal arg = args.cells[i];
       CType *formal = types.cons->head.type_val;
-      int check = is_instance_of(copy_type(arg.type), formal, g, 0, g_arity, &g_params);
+      int check = is_instance_of(copy_type(get_type(arg)), formal, g, 0, g_arity, &g_params);
       if (check < 0) {
         ok = 0;
         break;
       } else if (!check) {
-        raise_parameter_type_error(tag, copy_type(formal), copy_type(arg.type), i + 1, g, g_params, scope);
+        raise_parameter_type_error(tag, copy_type(formal), copy_type(get_type(arg)), i + 1, g, g_params, scope);
         ok = 0;
         break;
       }
-      record[i++] = arg;
+      i++;
       types = tail(types);
     }
   }
   NseVal result = undefined;
   if (ok) {
-    if (is_nil(args)) {
+    if (args.length == arity) {
       if (g_params) {
         t = get_instance(copy_generic(g), move_type_array(g_params));
         g_params = NULL;
         if (t) {
-          Data *d = create_data(t, tag, record, arity);
+          Data *d = create_data(t, tag, args.cells, arity);
           if (d) {
             result = DATA(d);
           }
         }
       } else {
-        Data *d = create_data(copy_type(t), tag, record, arity);
+        Data *d = create_data(copy_type(t), tag, args.cells, arity);
         if (d) {
           result = DATA(d);
         }
@@ -517,7 +882,6 @@ static NseVal apply_constructor(NseVal args, NseVal env[]) {
   if (g_params) {
     delete_type_array(g_params);
   }
-  free(record);
   return result;
 }
 
@@ -556,30 +920,22 @@ static NseVal eval_def_data_constructor(NseVal args, CType *t, Scope *scope) {
   }
 }
 
-static NseVal apply_generic_type(NseVal args, NseVal env[]) {
-  size_t arg_s;
-  NseVal *arg_a = list_to_array(args, &arg_s);
-  if (!arg_a) {
-    return undefined;
-  }
+static NseVal apply_generic_type(Slice args, NseVal env[]) {
   GType *g = env[0].reference->pointer;
-  if (arg_s != generic_type_arity(g)) {
-    free(arg_a);
-    raise_error(domain_error, "wrong number of parameters for generic type, expected %d, got %d", generic_type_arity(g), arg_s);
+  if (args.length != generic_type_arity(g)) {
+    raise_error(domain_error, "wrong number of parameters for generic type, expected %d, got %d", generic_type_arity(g), args.length);
     return undefined;
   }
-  CTypeArray *parameters = create_type_array_null(arg_s);
-  for (int i = 0; i < arg_s; i++) {
-    CType *t = to_type(arg_a[i]);
+  CTypeArray *parameters = create_type_array_null(args.length);
+  for (int i = 0; i < args.length; i++) {
+    CType *t = to_type(args.cells[i]);
     if (!t) {
       raise_error(domain_error, "generic type parameter must be a type");
-      free(arg_a);
       delete_type_array(parameters);
       return undefined;
     }
     parameters->elements[i] = copy_type(t);
   }
-  free(arg_a);
   CType *instance = get_instance(copy_generic(g), move_type_array(parameters));
   return check_alloc(TYPE(instance));
 }
@@ -718,48 +1074,6 @@ NseVal eval_def_data(NseVal args, Scope *scope) {
   return undefined;
 }
 
-NseVal eval_def_macro(NseVal args, Scope *scope) {
-  NseVal h = head(args);
-  if (RESULT_OK(h)) {
-    if (is_cons(h)) {
-      Symbol *symbol = to_symbol(head(h));
-      if (symbol) {
-        Scope *macro_scope = copy_scope(scope);
-        NseVal scope_ref = check_alloc(REFERENCE(create_reference(copy_type(scope_type), macro_scope, (Destructor) delete_scope)));
-        if (RESULT_OK(scope_ref)) {
-          NseVal body = tail(args);
-          NseVal formal = tail(h);
-          if (RESULT_OK(formal) && RESULT_OK(body)) {
-            NseVal def = check_alloc(CONS(create_cons(formal, body)));
-            if (RESULT_OK(def)) {
-              NseVal env[] = {def, scope_ref};
-              CType *func_type = parameters_to_type(head(def));
-              if (func_type) {
-                NseVal value = check_alloc(CLOSURE(create_closure(eval_anon, func_type, env, 2)));
-                del_ref(def);
-                if (RESULT_OK(value)) {
-                  module_define_macro(symbol, value);
-                  del_ref(scope_ref);
-                  del_ref(value);
-                  return add_ref(SYMBOL(symbol));
-                }
-              }
-            }
-          }
-          del_ref(scope_ref);
-        } else {
-          delete_scope(macro_scope);
-        }
-      } else {
-        raise_error(syntax_error, "name of macro must be a symbol");
-      }
-    } else {
-      raise_error(syntax_error, "macro must be a function");
-    }
-  }
-  return undefined;
-}
-
 static CType *parameters_to_gfunc_type(NseVal formal) {
   int min_arity = 0;
   int variadic = 0;
@@ -898,15 +1212,14 @@ NseVal eval_def_method(NseVal args, Scope *scope) {
   delete_scope(type_scope);
   NseVal result = undefined;
   if (RESULT_OK(parameters)) {
-    Scope *fn_scope = copy_scope(scope);
-    NseVal scope_ref = check_alloc(REFERENCE(create_reference(copy_type(scope_type), fn_scope, (Destructor) delete_scope)));
-    if (RESULT_OK(scope_ref)) {
-      NseVal func_def = check_alloc(CONS(create_cons(parameters, args)));
+    Compiler c;
+    if (init_compiler(&c, scope)) {
+      NseVal func_def = compile_lambda(parameters, args, &c);
       if (RESULT_OK(func_def)) {
-        NseVal env[] = {func_def, scope_ref};
+        NseVal env[] = {func_def};
         CType *func_type = get_closure_type(arity - variadic, variadic);
         if (func_type) {
-          NseVal func = check_alloc(CLOSURE(create_closure(eval_anon, func_type, env, 2)));
+          NseVal func = check_alloc(CLOSURE(create_closure(eval_anon, func_type, env, 1)));
           if (RESULT_OK(func)) {
             module_define_method(scope->module, symbol, copy_type_array(types), func);
             del_ref(func);
@@ -915,9 +1228,7 @@ NseVal eval_def_method(NseVal args, Scope *scope) {
         }
         del_ref(func_def);
       }
-      del_ref(scope_ref);
-    } else {
-      delete_scope(fn_scope);
+      delete_compiler(&c);
     }
     del_ref(parameters);
   }
@@ -925,175 +1236,159 @@ NseVal eval_def_method(NseVal args, Scope *scope) {
   return result;
 }
 
-static int eval_loop_ins(NseVal args, Scope *scope, ListBuilder *lb);
-
-/* (for PATTERN EXPR) */
-static int eval_loop_for(NseVal operands, NseVal rest, Scope *scope, ListBuilder *lb) {
-  NseVal pattern, sequence;
-  if (!accept_elem_any(&operands, &pattern)) {
-    set_debug_form(operands);
-    raise_error(syntax_error, "expected a pattern");
-    return 0;
-  }
-  if (!accept_elem_any(&operands, &sequence)) {
-    set_debug_form(operands);
-    raise_error(syntax_error, "expected a sequence");
+static int compile_loop_ins(LoopIns *ins, NseVal form, Compiler *c) {
+  Cons *cons = to_cons(form);
+  if (!cons) {
+    set_debug_form(form);
+    raise_error(syntax_error, "loop instruction must be a list");
     return 0;
   }
-  if (!expect_nil(&operands)) {
+  Symbol *op = to_symbol(cons->head);
+  NseVal operands = cons->tail;
+  if (!op) {
+    set_debug_form(cons->head);
+    raise_error(syntax_error, "loop operator must be a symbol");
     return 0;
-  }
-  NseVal sequence_value = eval(sequence, scope);
-  if (!RESULT_OK(sequence_value)) {
-    return 0;
-  }
-  int ok = 1;
-  NseVal current = sequence_value;
-  while (ok && is_cons(current)) {
-    Scope *loop_scope = scope;
-    if (!match_pattern(&loop_scope, pattern, head(current))) {
-      ok = 0;
-    } else {
-      current = tail(current);
-      if (!eval_loop_ins(rest, loop_scope, lb)) {
-        ok = 0;
-      }
+  } else if (op == for_symbol || op == let_symbol) {
+    /* (for PATTERN EXPR) or (let PATTERN EXPR) */
+    NseVal pattern, expr;
+    if (!accept_elem_any(&operands, &pattern)) {
+      set_debug_form(operands);
+      raise_error(syntax_error, "expected a pattern");
+      return 0;
     }
-    scope_pop_until(loop_scope, scope);
-  }
-  if (ok && !is_nil(current)) {
-  }
-  del_ref(sequence_value);
-  return ok;
-}
-
-/* (let PATTERN EXPR) */
-static int eval_loop_let(NseVal operands, NseVal rest, Scope *scope, ListBuilder *lb) {
-  NseVal pattern, assignment;
-  if (!accept_elem_any(&operands, &pattern)) {
-    set_debug_form(operands);
-    raise_error(syntax_error, "expected a pattern");
-    return 0;
-  }
-  if (!accept_elem_any(&operands, &assignment)) {
-    set_debug_form(operands);
-    raise_error(syntax_error, "expected an assignment");
-    return 0;
-  }
-  if (!expect_nil(&operands)) {
-    return 0;
-  }
-  NseVal assignment_value = eval(assignment, scope);
-  if (!RESULT_OK(assignment_value)) {
+    if (!accept_elem_any(&operands, &expr)) {
+      set_debug_form(operands);
+      raise_error(syntax_error, op == for_symbol ? "expected a sequence" : "expected an assignment");
+      return 0;
+    }
+    if (!expect_nil(&operands)) {
+      return 0;
+    }
+    ins->type = op == for_symbol ? LOOP_FOR : LOOP_LET;
+    ins->code = compile(expr, c);
+    if (!ins->code) {
+      return 0;
+    }
+    ins->pattern = compile_pattern(pattern, c);
+    return ins->pattern != NULL;
+  } else if (op == if_symbol || op == collect_symbol) {
+    /* (if EXPR) or (collect EXPR) */
+    NseVal expr;
+    if (!accept_elem_any(&operands, &expr)) {
+      set_debug_form(operands);
+      raise_error(syntax_error, op == if_symbol ? "expected a condition" : "expected an expression");
+      return 0;
+    }
+    if (!expect_nil(&operands)) {
+      return 0;
+    }
+    ins->type = op == if_symbol ? LOOP_IF : LOOP_COLLECT;
+    ins->code = compile(expr, c);
+  } else if (op == do_symbol) {
+    /* (do {STMT}) */
+    ins->type = LOOP_DO;
+    ins->code = compile_block(operands, c);
+  } else {
+    set_debug_form(cons->head);
+    raise_error(syntax_error, "unrecognized loop operator");
     return 0;
   }
-  Scope *let_scope = scope;
-  int result = 0;
-  if (match_pattern(&let_scope, pattern, assignment_value)) {
-    result = eval_loop_ins(rest, let_scope, lb);
-  }
-  scope_pop_until(let_scope, scope);
-  del_ref(assignment_value);
-  return result;
+  return ins->code != NULL;
 }
 
-/* (if EXPR) */
-static int eval_loop_if(NseVal operands, NseVal rest, Scope *scope, ListBuilder *lb) {
-  NseVal condition;
-  if (!accept_elem_any(&operands, &condition)) {
-    set_debug_form(operands);
-    raise_error(syntax_error, "expected a condition");
-    return 0;
+/* (loop {LOOP_INS}) */
+Code *compile_loop(NseVal args, Compiler *c) {
+  Code *code = create_code(CODE_LOOP, undefined);
+  if (!code) {
+    return NULL;
   }
-  if (!expect_nil(&operands)) {
-    return 0;
+  size_t size = 0;
+  for (NseVal ins = args; is_cons(ins); ins = tail(ins)) {
+    size++;
   }
-  NseVal condition_value = eval(condition, scope);
-  if (!RESULT_OK(condition_value)) {
-    return 0;
+  if (size > 0) {
+    code->loop.ins = allocate(sizeof(LoopIns) * size);
+    if (!code->loop.ins) {
+      delete_code(code);
+      return NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+      code->loop.ins[i] = (LoopIns){ .type = LOOP_DO, .pattern = NULL, .code = NULL };
+    }
+    code->loop.size = size;
   }
-  int result = 1;
-  if (is_true(condition_value)) {
-    result = eval_loop_ins(rest, scope, lb);
+  LexScope *start = c->scope;
+  for (size_t i = 0; i < size; i++) {
+    if (!compile_loop_ins(&code->loop.ins[i], head(args), c)) {
+      compile_pop_until(c, start);
+      delete_code(code);
+      return NULL;
+    }
+    args = tail(args);
   }
-  del_ref(condition_value);
-  return result;
+  compile_pop_until(c, start);
+  if (!is_nil(args)) {
+    set_debug_form(args);
+    raise_error(syntax_error, "expected a proper list");
+    delete_code(code);
+    return NULL;
+  }
+  return code;
 }
 
-/* (collect EXPR) */
-static int eval_loop_collect(NseVal operands, NseVal rest, Scope *scope, ListBuilder *lb) {
-  NseVal expr;
-  if (!accept_elem_any(&operands, &expr)) {
-    set_debug_form(operands);
-    raise_error(syntax_error, "expected an expression");
-    return 0;
-  }
-  if (!expect_nil(&operands)) {
-    return 0;
-  }
-  NseVal expr_value = eval(expr, scope);
-  if (!RESULT_OK(expr_value)) {
-    return 0;
+static int exec_loop_ins(Code *code, size_t index, Frame *frame, ListBuilder *lb) {
+  if (index >= code->loop.size) {
+    return 1;
   }
-  if (!list_builder_append(expr_value, lb)) {
-    del_ref(expr_value);
+  LoopIns *ins = &code->loop.ins[index];
+  NseVal value = exec(ins->code, frame);
+  if (!RESULT_OK(value)) {
     return 0;
   }
-  del_ref(expr_value);
-  return eval_loop_ins(rest, scope, lb);
-}
-
-/* (do {STMT}) */
-static int eval_loop_do(NseVal operands, NseVal rest, Scope *scope, ListBuilder *lb) {
-  if (RESULT_OK(eval_block(operands, scope))) {
-    return eval_loop_ins(rest, scope, lb);
-  }
-  return 0;
-}
-
-static int eval_loop_ins(NseVal args, Scope *scope, ListBuilder *lb) {
-  if (is_cons(args)) {
-    Cons *ins = to_cons(head(args));
-    if (!ins) {
-      set_debug_form(head(args));
-      raise_error(syntax_error, "loop instruction must be a list");
-    } else {
-      Symbol *op = to_symbol(ins->head);
-      if (!op) {
-        set_debug_form(ins->head);
-        raise_error(syntax_error, "loop operator must be a symbol");
-      } else if (op == for_symbol) {
-        return eval_loop_for(ins->tail, tail(args), scope, lb);
-      } else if (op == let_symbol) {
-        return eval_loop_let(ins->tail, tail(args), scope, lb);
-      } else if (op == if_symbol) {
-        return eval_loop_if(ins->tail, tail(args), scope, lb);
-      } else if (op == collect_symbol) {
-        return eval_loop_collect(ins->tail, tail(args), scope, lb);
-      } else if (op == do_symbol) {
-        return eval_loop_do(ins->tail, tail(args), scope, lb);
-      } else {
-        set_debug_form(ins->head);
-        raise_error(syntax_error, "unrecognized loop operator");
+  int ok = 1;
+  switch (ins->type) {
+    case LOOP_FOR: {
+      NseVal current = value;
+      while (ok && is_cons(current)) {
+        if (!match_pattern(ins->pattern, head(current), frame)) {
+          ok = 0;
+        } else {
+          current = tail(current);
+          ok = exec_loop_ins(code, index + 1, frame, lb);
+        }
       }
+      break;
     }
-  } else if (is_nil(args)) {
-    return 1;
-  } else {
-    set_debug_form(args);
-    raise_error(syntax_error, "expected a proper list");
+    case LOOP_LET: {
+      ok = match_pattern(ins->pattern, value, frame)
+        && exec_loop_ins(code, index + 1, frame, lb);
+      break;
+    }
+    case LOOP_IF:
+      if (is_true(value)) {
+        ok = exec_loop_ins(code, index + 1, frame, lb);
+      }
+      break;
+    case LOOP_COLLECT:
+      ok = list_builder_append(value, lb)
+        && exec_loop_ins(code, index + 1, frame, lb);
+      break;
+    case LOOP_DO:
+      ok = exec_loop_ins(code, index + 1, frame, lb);
+      break;
   }
-  return 0;
+  del_ref(value);
+  return ok;
 }
 
-/* (loop {LOOP_INS}) */
-NseVal eval_loop(NseVal args, Scope *scope) {
+NseVal exec_loop(Code *code, Frame *frame) {
   ListBuilder *lb = create_list_builder();
   if (!lb) {
     return undefined;
   }
   NseVal result = undefined;
-  if (eval_loop_ins(args, scope, lb)) {
+  if (exec_loop_ins(code, 0, frame, lb)) {
     result = list_builder_finalize(lb);
   }
   del_ref(LIST_BUILDER(lb));
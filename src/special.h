@@ -2,21 +2,39 @@
 #define NSE_SPECIAL_H
 
 #include "runtime/value.h"
+#include "compile.h"
+#include "eval.h"
+
+Code *compile_if(NseVal args, Compiler *c);
+Code *compile_let(NseVal args, Compiler *c);
+Code *compile_match(NseVal args, Compiler *c);
+Code *compile_fn(NseVal args, Compiler *c);
+Code *compile_try(NseVal args, Compiler *c);
+Code *compile_continue(NseVal args, Compiler *c);
+Code *compile_recur(NseVal args, Compiler *c);
+Code *compile_def(NseVal args, Compiler *c);
+Code *compile_def_read_macro(NseVal args, Compiler *c);
+Code *compile_def_macro(NseVal args, Compiler *c);
+Code *compile_loop(NseVal args, Compiler *c);
+
+/* Assigns the bindings of a let-form to the slots of `frame`. Returns 0 on
+ * error. */
+int exec_let_bindings(Code *code, Frame *frame);
+/* Evaluates the value of a match-form and assigns the bindings of the first
+ * matching case to the slots of `frame`. Returns the body of the case, or NULL
+ * on error. */
+Code *exec_match_case(Code *code, Frame *frame);
+NseVal exec_fn(Code *code, Frame *frame);
+NseVal exec_try(Code *code, Frame *frame);
+NseVal exec_def_func(Code *code, Frame *frame);
+NseVal exec_def_var(Code *code, Frame *frame);
+NseVal exec_def_read_macro(Code *code, Frame *frame);
+NseVal exec_def_macro(Code *code, Frame *frame);
+NseVal exec_loop(Code *code, Frame *frame);
 
-NseVal eval_if(NseVal args, Scope *scope);
-NseVal eval_let(NseVal args, Scope *scope);
-NseVal eval_match(NseVal args, Scope *scope);
-NseVal eval_fn(NseVal args, Scope *scope);
-NseVal eval_try(NseVal args, Scope *scope);
-NseVal eval_continue(NseVal args, Scope *scope);
-NseVal eval_recur(NseVal args, Scope *scope);
-NseVal eval_def(NseVal args, Scope *scope);
-NseVal eval_def_read_macro(NseVal args, Scope *scope);
 NseVal eval_def_type(NseVal args, Scope *scope);
 NseVal eval_def_data(NseVal args, Scope *scope);
-NseVal eval_def_macro(NseVal args, Scope *scope);
 NseVal eval_def_generic(NseVal args, Scope *scope);
 NseVal eval_def_method(NseVal args, Scope *scope);
-NseVal eval_loop(NseVal args, Scope *scope);
 
 #endif
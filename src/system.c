@@ -4,17 +4,19 @@
 #include "runtime/value.h"
 #include "runtime/error.h"
 #include "runtime/validate.h"
+#include "runtime/pool.h"
+#include "runtime/cycle.h"
 #include "util/stream.h"
 #include "write.h"
 
 #include "system.h"
 
-static NseVal sum(NseVal args) {
+static NseVal sum(Slice args) {
   int64_t acc = 0;
   double facc = 0.0;
   int fp = 0;
-  while (is_cons(args)) {
-    NseVal h = head(args);
+  for (size_t i = 0; i < args.length; i++) {
+    NseVal h = args.cells[i];
     if (h.type == i64_type) {
       acc += h.i64;
     } else if (h.type == f64_type) {
@@ -24,7 +26,6 @@ static NseVal sum(NseVal args) {
       raise_error(domain_error, "expected number");
       return undefined;
     }
-    args = tail(args);
   }
   if (fp) {
     return F64(acc + facc);
@@ -32,11 +33,11 @@ static NseVal sum(NseVal args) {
   return I64(acc);
 }
 
-static NseVal subtract(NseVal args) {
+static NseVal subtract(Slice args) {
   int64_t acc = 0;
   double facc = 0.0;
   int fp = 0;
-  NseVal h = head(args);
+  NseVal h = slice_pop(&args);
   if (h.type == i64_type) {
     acc = h.i64;
   } else if (h.type == f64_type) {
@@ -46,15 +47,14 @@ static NseVal subtract(NseVal args) {
     raise_error(domain_error, "expected number");
     return undefined;
   }
-  args = tail(args);
-  if (!is_cons(args)) {
+  if (args.length == 0) {
     if (fp) {
       return F64(-facc);
     }
     return I64(-acc);
   }
-  do {
-    h = head(args);
+  for (size_t i = 0; i < args.length; i++) {
+    h = args.cells[i];
     if (h.type == i64_type) {
       acc -= h.i64;
     } else if (h.type == f64_type) {
@@ -64,20 +64,19 @@ static NseVal subtract(NseVal args) {
       raise_error(domain_error, "expected number");
       return undefined;
     }
-    args = tail(args);
-  } while (is_cons(args));
+  }
   if (fp) {
     return F64(acc - facc);
   }
   return I64(acc);
 }
 
-static NseVal product(NseVal args) {
+static NseVal product(Slice args) {
   int64_t acc = 1;
   double facc = 1.0;
   int fp = 0;
-  while (is_cons(args)) {
-    NseVal h = head(args);
+  for (size_t i = 0; i < args.length; i++) {
+    NseVal h = args.cells[i];
     if (h.type == i64_type) {
       acc *= h.i64;
     } else if (h.type == f64_type) {
@@ -87,7 +86,6 @@ static NseVal product(NseVal args) {
       raise_error(domain_error, "expected number");
       return undefined;
     }
-    args = tail(args);
   }
   if (fp) {
     return F64(acc * facc);
@@ -95,8 +93,8 @@ static NseVal product(NseVal args) {
   return I64(acc);
 }
 
-static NseVal divide(NseVal args) {
-  NseVal h = head(args);
+static NseVal divide(Slice args) {
+  NseVal h = slice_pop(&args);
   double acc;
   if (h.type == i64_type) {
     acc = h.i64;
@@ -106,12 +104,11 @@ static NseVal divide(NseVal args) {
     raise_error(domain_error, "expected number");
     return undefined;
   }
-  args = tail(args);
-  if (!is_cons(args)) {
+  if (args.length == 0) {
     return F64(1.0 / acc);
   }
-  do {
-    h = head(args);
+  for (size_t i = 0; i < args.length; i++) {
+    h = args.cells[i];
     if (h.type == i64_type) {
       acc /= h.i64;
     } else if (h.type == f64_type) {
@@ -120,15 +117,14 @@ static NseVal divide(NseVal args) {
       raise_error(domain_error, "expected number");
       return undefined;
     }
-    args = tail(args);
-  } while (is_cons(args));
+  }
   return F64(acc);
 }
 
-static NseVal equals(NseVal args) {
+static NseVal equals(Slice args) {
   NseVal previous = undefined;
-  while (args.type->internal == INTERNAL_CONS) {
-    NseVal h = head(args);
+  for (size_t i = 0; i < args.length; i++) {
+    NseVal h = args.cells[i];
     if (previous.type) {
       NseVal result = nse_equals(previous, h);
       if (!is_true(result)) {
@@ -136,7 +132,6 @@ static NseVal equals(NseVal args) {
       }
     }
     previous = h;
-    args = tail(args);
   }
   if (!RESULT_OK(previous)) {
     raise_error(domain_error, "too few arguments");
@@ -144,20 +139,20 @@ static NseVal equals(NseVal args) {
   return TRUE;
 }
 
-static NseVal apply(NseVal args) {
+static NseVal apply(Slice args) {
   ARG_POP_ANY(func, args);
   ARG_POP_ANY(func_args, args);
   ARG_DONE(args);
   return nse_apply(func, func_args);
 }
 
-static NseVal symbol_name(NseVal args) {
+static NseVal symbol_name(Slice args) {
   ARG_POP_TYPE(Symbol *, symbol, args, to_symbol, "a symbol");
   ARG_DONE(args);
   return check_alloc(STRING(create_string(symbol->name, strlen(symbol->name))));
 }
 
-static NseVal symbol_module(NseVal args) {
+static NseVal symbol_module(Slice args) {
   ARG_POP_TYPE(Symbol *, symbol, args, to_symbol, "a symbol");
   ARG_DONE(args);
   if (!symbol->module) {
@@ -167,7 +162,7 @@ static NseVal symbol_module(NseVal args) {
   return check_alloc(STRING(create_string(name, strlen(name))));
 }
 
-static NseVal module_symbols(NseVal args) {
+static NseVal module_symbols(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   const char *name = to_string_constant(arg);
@@ -184,13 +179,41 @@ static NseVal module_symbols(NseVal args) {
   return undefined;
 }
 
-static NseVal byte_length(NseVal args) {
+static NseVal pool_stats(Slice args) {
+  ARG_DONE(args);
+  // Queued values are still counted as live
+  flush_deleted();
+  NseVal classes[POOL_CLASSES];
+  size_t size = 0;
+  int ok = 1;
+  for (size_t i = 0; i < POOL_CLASSES && ok; i++) {
+    PoolStats stats = get_pool_stats(i);
+    if (stats.slabs) {
+      NseVal cells[] = { I64(stats.size), I64(stats.live), I64(stats.peak), I64(stats.slabs) };
+      classes[size] = slice_to_list(SLICE(cells, 4));
+      ok = RESULT_OK(classes[size]);
+      size += ok;
+    }
+  }
+  NseVal result = ok ? slice_to_list(SLICE(classes, size)) : undefined;
+  for (size_t i = 0; i < size; i++) {
+    del_ref(classes[i]);
+  }
+  return result;
+}
+
+static NseVal collect_cycles_(Slice args) {
+  ARG_DONE(args);
+  return I64(collect_cycles());
+}
+
+static NseVal byte_length(Slice args) {
   ARG_POP_TYPE(String *, string, args, to_string, "a string");
   ARG_DONE(args);
   return I64(string->length);
 }
 
-static NseVal byte_at(NseVal args) {
+static NseVal byte_at(Slice args) {
   ARG_POP_I64(n, args);
   ARG_POP_TYPE(String *, string, args, to_string, "a string");
   ARG_DONE(args);
@@ -201,19 +224,29 @@ static NseVal byte_at(NseVal args) {
   return I64((unsigned char) string->chars[n]);
 }
 
-static NseVal syntax_to_datum_(NseVal args) {
+static NseVal syntax_to_datum_(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
   return syntax_to_datum(arg);
 }
 
-static NseVal update_head(NseVal args) {
+NseVal cons_(Slice args) {
+  ARG_POP_ANY(head, args);
+  ARG_POP_ANY(tail, args);
+  ARG_DONE(args);
+  return check_alloc(CONS(create_cons(head, tail)));
+}
+
+static NseVal update_head(Slice args) {
   ARG_POP_TYPE(Cons *, cons, args, to_cons, "a cons");
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
-  if (cons->refs == 1) {
+  if (cons->header.refs == 1) {
     NseVal old_head = cons->head;
     cons->head = add_ref(arg);
+    // The cached element type may no longer apply to the new head
+    delete_type(cons->type);
+    cons->type = NULL;
     add_ref(CONS(cons));
     del_ref(old_head);
   } else {
@@ -222,16 +255,17 @@ static NseVal update_head(NseVal args) {
   return check_alloc(CONS(cons));
 }
 
-static NseVal type_of(NseVal args) {
+static NseVal type_of(Slice args) {
   ARG_POP_ANY(arg, args);
   ARG_DONE(args);
-  return TYPE(copy_type(arg.type));
+  return TYPE(copy_type(get_type(arg)));
 }
 
-static NseVal is_a(NseVal args) {
-  NseVal a = head(args);
-  NseVal b = elem(1, args);
-  CType *type_a = a.type;
+static NseVal is_a(Slice args) {
+  ARG_POP_ANY(a, args);
+  ARG_POP_ANY(b, args);
+  ARG_DONE(args);
+  CType *type_a = get_type(a);
   CType *type_b = to_type(b);
   if (!type_b) {
     return undefined;
@@ -239,7 +273,7 @@ static NseVal is_a(NseVal args) {
   return is_subtype_of(type_a, type_b) ? TRUE : FALSE;
 }
 
-static NseVal open_stream(NseVal args) {
+static NseVal open_stream(Slice args) {
   ARG_POP_TYPE(String *, name, args, to_string, "a string");
   ARG_POP_TYPE(String *, mode, args, to_string, "a string");
   ARG_DONE(args);
@@ -252,7 +286,7 @@ static NseVal open_stream(NseVal args) {
   return undefined;
 }
 
-static NseVal stream_write_(NseVal args) {
+static NseVal stream_write_(Slice args) {
   ARG_POP_TYPE(String *, str, args, to_string, "a string");
   ARG_POP_REF(Stream *, f, args, stream_type);
   ARG_DONE(args);
@@ -260,7 +294,7 @@ static NseVal stream_write_(NseVal args) {
   return nil;
 }
 
-static NseVal stream_read_(NseVal args) {
+static NseVal stream_read_(Slice args) {
   ARG_POP_I64(bytes, args);
   ARG_POP_REF(Stream *, f, args, stream_type);
   ARG_DONE(args);
@@ -274,13 +308,13 @@ static NseVal stream_read_(NseVal args) {
   return check_alloc(STRING(return_value));
 }
 
-static NseVal get_list_type(NseVal args) {
+static NseVal get_list_type(Slice args) {
   ARG_POP_TYPE(CType *, type_a, args, to_type, "a type");
   ARG_DONE(args);
   return TYPE(get_unary_instance(copy_generic(list_type), copy_type(type_a)));
 }
 
-static NseVal construct_string(NseVal args) {
+static NseVal construct_string(Slice args) {
   size_t size = 32;
   char *buffer = (char *)malloc(size);
   Stream *stream = stream_buffer(buffer, 32, 0);
@@ -288,8 +322,8 @@ static NseVal construct_string(NseVal args) {
     raise_error(out_of_memory_error, "could not allocate stream");
     return undefined;
   }
-  NseVal elem;
-  while (accept_elem_any(&args, &elem)) {
+  for (size_t i = 0; i < args.length; i++) {
+    NseVal elem = args.cells[i];
     String *s = to_string(elem);
     if (s) {
       stream_write(s->chars, 1, s->length, stream);
@@ -311,9 +345,12 @@ Module *get_system_module() {
   module_ext_define(system, "/", FUNC(divide, 1, 1));
   module_ext_define(system, "=", FUNC(equals, 1, 1));
   module_ext_define(system, "apply", FUNC(apply, 2, 0));
+  module_ext_define(system, "cons", FUNC(cons_, 2, 0));
   module_ext_define(system, "symbol-name", FUNC(symbol_name, 1, 0));
   module_ext_define(system, "symbol-module", FUNC(symbol_module, 1, 0));
   module_ext_define(system, "module-symbols", FUNC(module_symbols, 1, 0));
+  module_ext_define(system, "pool-stats", FUNC(pool_stats, 0, 0));
+  module_ext_define(system, "collect-cycles", FUNC(collect_cycles_, 0, 0));
   module_ext_define(system, "string", FUNC(construct_string, 0, 0));
   module_ext_define(system, "byte-length", FUNC(byte_length, 1, 0));
   module_ext_define(system, "byte-at", FUNC(byte_at, 2, 0));
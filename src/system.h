@@ -4,5 +4,8 @@
 #include "eval.h"
 
 Module *get_system_module();
+/* (cons HEAD TAIL), recognized by the compiler in calls modulo cons (see
+ * `optimize_tail_call()`). */
+NseVal cons_(Slice args);
 
 #endif
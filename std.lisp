@@ -33,7 +33,6 @@
 (def nil '())
 (def (nil? xs) (= xs nil))
 (def (list &rest xs) xs)
-(def (cons head tail) (list head . tail))
 (def (head &match (h . t)) h)
 (def (tail &match (h . t)) t)
 
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs the behaviour tests in tests/lisp. Every test with a .out file is loaded
+# by the interpreter, and its output is compared with the .out file.
+cd "$(dirname "$0")/.." || exit 1
+status=0
+for test in tests/lisp/*.lisp; do
+  expected="${test%.lisp}.out"
+  if [ ! -f "$expected" ]; then
+    continue
+  fi
+  printf '%s...' "$test"
+  # Strip the prompts and terminal escape sequences written by readline
+  if echo "(load \"$test\")" | ./nse 2>&1 \
+      | sed -e 's/\x1b\[[0-9;]*[a-zA-Z]//g' -e 's/\x1b\[[0-9]*@//g' \
+      | grep -v -e '^user>' -e '^Bye\.$' | diff "$expected" - > "${test%.lisp}.diff"; then
+    rm -f "${test%.lisp}.diff"
+    printf 'ok\n'
+  else
+    printf 'failed, see %s\n' "${test%.lisp}.diff"
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,27 @@
+(load "tests/lisp/check.lisp")
+
+;;; Arguments are passed as slices, with an optional rest list from apply and
+;;; dotted calls
+
+(def (args &rest xs) xs)
+(def (opt a &opt (b 2) c) (list a b c))
+(def (key a &key (b 2) c) (list a b c))
+
+(check 'apply-builtin 6 (apply + '(1 2 3)))
+(check 'apply-lambda '(1 2) (apply args '(1 2)))
+(check 'apply-no-arguments '() (apply args '()))
+(check 'apply-optional '(1 2 ()) (apply opt '(1)))
+(check 'apply-keyword '(1 5 ()) (apply key '(1 :b 5)))
+
+(def ys '(2 3))
+(check 'dotted-call '(1 2 3) (args 1 . ys))
+(check 'dotted-builtin 6 (+ 1 . ys))
+
+(check 'optional '(1 4 5) (opt 1 4 5))
+(check 'keyword-default '(1 2 ()) (key 1))
+(check 'keywords '(1 3 4) (key 1 :c 4 :b 3))
+
+(def (two a b) (list a b))
+(def improper '(2 . 3))
+(check 'dotted-call-improper-tail 'error/domain-error (head (try (two 1 . improper))))
+(check 'dotted-call-constant-tail 'error/syntax-error (head (try (two 1 . 5))))
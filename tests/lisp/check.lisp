@@ -0,0 +1,7 @@
+;;;; Assertions used by the behaviour tests, see ../lisp-test.sh
+
+(def (check name expected actual)
+     "Prints name followed by ok if actual is equal to expected"
+     (println (write (if (= expected actual)
+                       (list name 'ok)
+                       (list name 'expected expected 'got actual)))))
@@ -0,0 +1,43 @@
+(load "tests/lisp/check.lisp")
+
+;;; Closures capture the variables they refer to
+
+(def (adder n) (fn (x) (+ x n)))
+(check 'free-variable 7 ((adder 3) 4))
+
+(def (nested a) (fn (b) (fn (c) (list a b c))))
+(check 'nested-closures '(1 2 3) (((nested 1) 2) 3))
+
+(def (counter-list n) (map (fn (i) (fn () (* i n))) (range 1 3)))
+(check 'closures-in-map '(2 4 6) (map (fn (f) (f)) (counter-list 2)))
+
+;;; Macros are unhygienic, so their expansions can refer to any local variable
+
+(def-macro (get-x) 'x)
+(def (macro-before x) (fn () (get-x)))
+(check 'macro-defined-before 5 ((macro-before 5)))
+
+(def (macro-after x) (fn () (get-x-later)))
+(def-macro (get-x-later) 'x)
+(check 'macro-defined-after 6 ((macro-after 6)))
+
+(def (outer-macro x) (fn (y) (fn () (list y (get-x)))))
+(check 'macro-in-nested-closure '(2 1) (((outer-macro 1) 2)))
+
+;; A call to a macro that is already defined captures only the variables of its
+;; expansion
+(def (live-conses) (elem 1 (elem 3 (pool-stats))))
+(def (retained make)
+     (let ((before (live-conses)))
+       (let ((f (make (range 1 1000))))
+         (- (live-conses) before))))
+(def (ignore-list xs) (fn (y) (and (= y 2) y)))
+(check 'macro-call-captures-expansion-only 0 (retained ignore-list))
+(check 'macro-call-in-closure 2 ((ignore-list '()) 2))
+
+;; Expansions that can't be made when compiling are left until the call is executed
+(def-macro (forever) '(if false (forever) 1))
+(check 'recursive-expansion 1 (forever))
+(def-macro (head-of x) (head x))
+(def (never-expanded) (if false (head-of 1) 'ok))
+(check 'failing-expansion 'ok (never-expanded))
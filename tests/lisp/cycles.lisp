@@ -0,0 +1,45 @@
+(load "tests/lisp/check.lisp")
+
+(collect-cycles)
+
+(def (make-counter)
+     (let ((f (fn (n) (if (= n 0) 0 (+ 1 (f (- n 1)))))))
+       f))
+(def counter (make-counter))
+(check 'reachable-cycle-kept 0 (collect-cycles))
+(check 'kept-closure-works 5 (counter 5))
+(def counter nil)
+(check 'dropped-cycle-collected 2 (collect-cycles))
+
+(def (make-pair)
+     (let ((g (fn (n) (list (f n) n)))
+           (f (fn (n) (if (= n 0) 'done (f (- n 1))))))
+       g))
+(def pair (make-pair))
+(check 'mutual-closures-work '(done 3) (pair 3))
+(collect-cycles)
+(check 'mutual-closures-kept '(done 3) (pair 3))
+
+(def (self-list) (let ((d (list 1 (fn () d)))) d))
+(def data (self-list))
+(check 'data-cycle-works 1 (head ((elem 1 data))))
+(def data nil)
+(check 'data-cycle-collected 4 (collect-cycles))
+
+(def (spin n) (let ((r (fn (k) (if (= k 0) 0 (+ 1 (r (- k 1))))))) (r n)))
+(def (repeat n) (if (= n 0) 0 (do (spin 3) (repeat (- n 1)))))
+(repeat 1000)
+(check 'temporary-cycles-collected 2000 (collect-cycles))
+(check 'nothing-left 0 (collect-cycles))
+
+;; Cycles are collected when functions return, so a long form doesn't
+;; accumulate them
+(check 'collected-within-form 1090 (do (repeat 20000) (collect-cycles)))
+
+;; A local function that only calls itself in tail position is a loop, so it
+;; needs no box and forms no cycle
+(def (count-down n) (if (= n 0) 0 (do (length '(1 2 3)) (count-down (- n 1)))))
+(check 'tail-recursive-local-no-cycle 0 (do (count-down 10000) (collect-cycles)))
+(def (loop-in-let n) (let ((r (fn (k acc) (if (= k 0) acc (r (- k 1) (+ acc 1)))))) (r n 0)))
+(check 'tail-recursive-local-works 100 (loop-in-let 100))
+(check 'tail-recursive-let-no-cycle 0 (do (loop-in-let 10) (collect-cycles)))
@@ -0,0 +1,21 @@
+(load "tests/lisp/check.lisp")
+
+(def (live-conses) (elem 1 (elem 3 (pool-stats))))
+
+(def before (live-conses))
+(def big (range 1 1000000))
+(def allocated (live-conses))
+(def big nil)
+(def freed (live-conses))
+(check 'million-allocated 1000000 (- allocated before))
+(check 'million-freed before freed)
+
+(def nested (map (fn (x) (list x x)) (range 1 100000)))
+(def nested nil)
+(def freed (live-conses))
+(check 'nested-freed before freed)
+
+(def shared (range 1 1000))
+(def outer (map (fn (x) shared) (range 1 1000)))
+(def outer nil)
+(check 'shared-tail-survives 1000 (length shared))
@@ -0,0 +1,17 @@
+(load "tests/lisp/check.lisp")
+
+;;; Redefining a method invalidates the dispatch caches of generic functions
+
+(def-generic (gf x))
+(def-method (gf (x ^i64)) 'int)
+(def-method (gf (x ^string)) 'string)
+(check 'first-call 'int (gf 1))
+(check 'cached-call 'int (gf 1))
+(check 'second-entry 'string (gf "a"))
+
+(def-method (gf (x ^i64)) 'int2)
+(check 'redefined 'int2 (gf 1))
+(check 'redefined-cached 'int2 (gf 1))
+(check 'other-entry 'string (gf "a"))
+(check 'other-entry-cached 'string (gf "a"))
+(check 'redefined-after-other 'int2 (gf 1))
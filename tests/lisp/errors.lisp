@@ -0,0 +1,19 @@
+(load "tests/lisp/check.lisp")
+
+;;; Error messages of caught errors
+
+(def (error-type result) (head result))
+(def (error-message result) (head (tail result)))
+
+(check 'constant-message "expected list" (error-message (try (head '()))))
+(check 'formatted-message "undefined name: undefined-fn" (error-message (try (undefined-fn 1))))
+
+(def first-error (try (undefined-a 1)))
+(def second-error (try (undefined-b 1)))
+(check 'message-survives-next-error "undefined name: undefined-a" (error-message first-error))
+(check 'next-message "undefined name: undefined-b" (error-message second-error))
+
+(def long-error (try (long-xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx 1)))
+(check 'long-message-length 316 (byte-length (error-message long-error)))
+(check 'short-message-after-long "undefined name: undefined-c" (error-message (try (undefined-c 1))))
+(check 'error-type 'error/name-error (error-type long-error))
@@ -0,0 +1,18 @@
+(load "tests/lisp/check.lisp")
+
+;;; Frames are allocated from a stack and released when a function returns
+
+(def (deep n) (if (= n 0) '() (let ((a n) (b (* n 2))) (let ((rest (deep (- n 1)))) (cons (+ a b) rest)))))
+(check 'locals-survive-recursion '(15 12 9 6 3) (deep 5))
+(check 'deep-recursion 3000 (length (deep 3000)))
+
+(def (keep-closures n) (if (= n 0) '() (let ((x (* n n))) (cons (fn () x) (keep-closures (- n 1))))))
+(check 'closures-outlive-frames '(9 4 1) (map (fn (f) (f)) (keep-closures 3)))
+
+(def (many-slots a b c d e f g h i j) (let ((k (+ a j)) (l (+ b i))) (list k l (+ c d e f g h))))
+(check 'many-slots '(11 11 33) (many-slots 1 2 3 4 5 6 7 8 9 10))
+
+(def (fails x) (let ((y (+ x 1))) (head '())))
+(try (fails 1))
+(check 'frames-released-after-error 3 (let ((a 1) (b 2)) (+ a b)))
+(check 'recursion-after-error 3000 (length (deep 3000)))
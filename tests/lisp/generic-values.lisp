@@ -0,0 +1,20 @@
+(load "tests/lisp/check.lisp")
+
+;;; Evaluating the name of a generic function reuses its bound copy
+
+(def-generic (size x))
+(def-method (size (x ^string)) (byte-length x))
+(def-method (size (x ^proper-list)) (length x))
+
+;; The methods are those of this module, even when the value is applied in std.lisp
+(check 'generic-as-argument '(3 2) (map size (list "abc" '(1 2))))
+
+(def saved size)
+(check 'saved-value 4 (saved "abcd"))
+
+;; Methods defined after the value was taken are used by the value
+(def-method (size (x ^i64)) x)
+(check 'method-added-later 7 (saved 7))
+
+(def (sizes n acc) (if (= n 0) acc (sizes (- n 1) (+ acc (apply size (list "ab"))))))
+(check 'repeated-evaluation 2000 (sizes 1000 0))
@@ -0,0 +1,19 @@
+(load "tests/lisp/check.lisp")
+
+(def (symbols n) (if (= n 0) nil (cons 'some-symbol (symbols (- n 1)))))
+(def many (symbols 10000))
+(def many nil)
+(check 'interned-symbol-kept "some-symbol" (symbol-name 'some-symbol))
+(check 'symbols-identical true (= 'some-symbol (head (symbols 1))))
+
+(def (types n) (if (= n 0) nil (cons (type-of n) (types (- n 1)))))
+(def many (types 10000))
+(def many nil)
+(check 'built-in-type-kept ^i64 (type-of 1))
+(check 'built-in-type-usable true (is-a 1 (type-of 2)))
+
+(def-data box (box v))
+(def boxes (map box (range 1 1000)))
+(def boxes nil)
+(collect-cycles)
+(check 'data-type-kept ^box (type-of (box 1)))
@@ -0,0 +1,28 @@
+(load "tests/lisp/check.lisp")
+
+;;; The element type of a list is computed when it is first needed
+
+(check 'literal-list ^(list i64) (type-of '(1 2 3)))
+(check 'mixed-list ^(list any) (type-of (list 1 "a")))
+(check 'consed-list ^(list i64) (type-of (cons 1 (cons 2 '()))))
+(check 'mapped-list ^(list string) (type-of (map (fn (x) "s") (range 1 100))))
+(check 'filtered-list ^(list i64) (type-of (filter (fn (x) (= x 1)) (range 1 100))))
+(check 'improper-list ^improper-list (type-of (cons 1 2)))
+(check 'empty-list ^nil (type-of '()))
+
+(def xs (range 1 10))
+(check 'tail-of-list ^(list i64) (type-of (tail xs)))
+(check 'cons-onto-typed-list ^(list any) (type-of (cons "a" xs)))
+(check 'same-list-twice ^(list i64) (type-of xs))
+
+(check 'is-a-element-type true (is-a (range 1 5) ^(list i64)))
+(check 'is-a-other-element-type false (is-a (range 1 5) ^(list string)))
+
+(def-generic (elements x))
+(def-method (elements (x ^(list i64))) 'ints)
+(def-method (elements (x ^(list string))) 'strings)
+(check 'dispatch-on-element-type '(ints strings) (list (elements (range 1 3)) (elements (list "a" "b"))))
+
+(def (typed xs) (do (elements xs) xs))
+(check 'updated-head-type ^(list string) (type-of (update-head (typed (list 1)) "a")))
+(check 'dispatch-on-updated-head 'strings (elements (update-head (typed (range 1 1)) "a")))
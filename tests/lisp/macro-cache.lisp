@@ -0,0 +1,29 @@
+(load "tests/lisp/check.lisp")
+
+;;; Macro expansions are compiled once per call site and recompiled when the
+;;; macro is redefined
+
+(def-macro (m x) (list '+ x 1))
+(def (f x) (m x))
+(check 'first-expansion 2 (f 1))
+(check 'cached-expansion 3 (f 2))
+(def-macro (m x) (list '* x 10))
+(check 'redefined-macro 10 (f 1))
+
+;; Each call site has its own expansion
+(def (g x) (list (m x) (m (+ x 1))))
+(check 'call-sites '(10 20) (g 1))
+
+;; Redefining a macro while an expansion of it is being executed
+(def (redefine-during n)
+     (if (= n 0)
+       0
+       (do (if (= n 3) (def-macro (m x) (list '- x 100)) nil)
+         (+ (m n) (redefine-during (- n 1))))))
+(check 'redefined-during-execution -204 (redefine-during 5))
+(check 'after-redefinition -485 (redefine-during 5))
+
+(def-macro (r x) (list 'if (list '= x 0) 0 (list '+ 1 (list 'h (list '- x 1)))))
+(def (h n) (if (= n 2) (do (def-macro (r x) (list '* x 1000)) (r n)) (r n)))
+(check 'redefined-in-own-expansion 2002 (h 4))
+(check 'after-redefinition-in-own-expansion 4000 (h 4))
@@ -0,0 +1,19 @@
+(load "tests/lisp/check.lisp")
+
+;;; Calls skip the macro lookup for names that have never named a macro
+
+(def (plain x) (* x 2))
+(def (call-plain n acc) (if (= n 0) acc (call-plain (- n 1) (+ acc (plain n)))))
+(check 'plain-function-calls 110 (call-plain 10 0))
+
+;; A name that becomes a macro after a call to it was compiled
+(def (becomes-macro x) 'function)
+(def (call-becomes-macro) (becomes-macro 1))
+(check 'before-macro-definition 'function (call-becomes-macro))
+(def-macro (becomes-macro x) ''macro)
+(check 'after-macro-definition 'macro (call-becomes-macro))
+
+;; A call to a name that is defined as a macro later
+(def (call-undefined) (defined-later 2))
+(def-macro (defined-later x) (list '+ x 40))
+(check 'macro-defined-later 42 (call-undefined))
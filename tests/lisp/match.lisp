@@ -0,0 +1,41 @@
+(load "tests/lisp/check.lisp")
+
+;;; Match selects the cases that can match the constructor of a data value
+
+(def-data expr (num n) (add a b) (mul a b) (neg a) zero)
+
+(def (ev e)
+     (match e
+            (('num n) n)
+            (('add a b) (+ (ev a) (ev b)))
+            (('mul a b) (* (ev a) (ev b)))
+            (('neg a) (- 0 (ev a)))
+            ('zero 0)))
+(check 'constructors -10 (ev (add (num 2) (mul (num 3) (neg (num 4))))))
+(check 'constructor-without-parameters 0 (ev zero))
+
+;; Cases are tried in order, including cases without a constructor
+(def (f x) (match x (('num 1) 'one) (('num n) n) (y (list 'other y))))
+(check 'literal-in-constructor 'one (f (num 1)))
+(check 'next-case-same-constructor 5 (f (num 5)))
+(check 'catch-all-case (list 'other zero) (f zero))
+(check 'list-matches-constructor-pattern 'one (f '(num 1)))
+(check 'symbol-is-not-data '(other zero) (f 'zero))
+
+(def (g x) (match x ('zero 'z) ((a b) (list a b)) (5 'five) (() 'nil)))
+(check 'data-before-list 'z (g zero))
+(check 'quoted-symbol 'z (g 'zero))
+(check 'list-pattern '(1 2) (g '(1 2)))
+(check 'number-pattern 'five (g 5))
+(check 'nil-pattern 'nil (g '()))
+(check 'no-matching-case 'error/pattern-error (head (try (g 7))))
+(check 'data-with-wrong-arity 'error/pattern-error (head (try (g (num 1)))))
+
+(def (h x) (match x (('add ('num a) b) a) (('add a b) 'other)))
+(check 'nested-constructor 1 (h (add (num 1) zero)))
+(check 'nested-constructor-mismatch 'other (h (add zero zero)))
+
+;; A case that fails after binding some variables leaves no trace
+(def (p x) (match x (('add ('num a) ('num 0)) (list 'zero a)) (('add ('num b) ('num a)) (list b a))))
+(check 'partial-match-rebound '(1 2) (p (add (num 1) (num 2))))
+(check 'partial-match-first-case '(zero 1) (p (add (num 1) (num 0))))
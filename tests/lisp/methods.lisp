@@ -0,0 +1,61 @@
+(load "tests/lisp/check.lisp")
+
+;;; The most specific applicable method is selected
+
+(def-generic (describe-num x))
+(def-method (describe-num (x ^any)) 'any)
+(def-method (describe-num (x ^num)) 'num)
+(def-method (describe-num (x ^i64)) 'i64)
+(check 'most-specific 'i64 (describe-num 1))
+(check 'supertype 'num (describe-num 1.5))
+(check 'fallback 'any (describe-num "a"))
+
+(def-generic (pair a b))
+(def-method (pair (a ^num) (b ^any)) 'num-any)
+(def-method (pair (a ^any) (b ^i64)) 'any-i64)
+(check 'leftmost-parameter-decides 'num-any (pair 1 2))
+(check 'second-parameter 'any-i64 (pair "a" 2))
+
+;;; Methods of other generic functions are not candidates
+
+(def-generic (other x))
+(def-method (other (x ^string)) 'other)
+(check 'separate-generics 'any (describe-num "b"))
+(check 'other-generic 'other (other "b"))
+
+;;; The dispatch table of a module is cleared when it is full
+
+(def-generic (kind x))
+(def-method (kind (x ^any)) 'other)
+(def-method (kind (x ^proper-list)) 'list)
+(def (count-lists n x acc)
+     (if (= n 0)
+       acc
+       (count-lists (- n 1) (list x) (if (= (kind x) 'list) (+ acc 1) acc))))
+;; Every nesting depth is a different argument type
+(check 'many-argument-types 1499 (count-lists 1500 0 0))
+(check 'after-clearing 'list (kind '(((1)))))
+(check 'after-clearing-other 'other (kind 1))
+
+;;; Of two equally specific methods the one defined first is selected
+
+(def-generic (first-defined x))
+(def-method (first-defined (x ^(list string))) 'strings)
+(def-method (first-defined (x ^(list i64))) 'ints)
+(check 'equally-specific 'strings (first-defined '()))
+
+(def-module :tied-methods)
+(export 'tied)
+(def-generic (tied x))
+(def-method (tied (x ^(list symbol))) 'symbols)
+(def-method (tied (x ^(list string))) 'strings)
+(def-method (tied (x ^(list i64))) 'ints)
+(def-method (tied (x ^(list f64))) 'floats)
+(def-method (tied (x ^(list type))) 'types)
+(def-method (tied (x ^(list num))) 'nums)
+(def-method (tied (x ^(list any))) 'anys)
+(def-method (tied (x ^(list proper-list))) 'lists)
+(def-method (tied (x ^(list improper-list))) 'improper-lists)
+(in-module :user)
+(import :tied-methods)
+(check 'equally-specific-imported "symbols" (symbol-name (tied '())))
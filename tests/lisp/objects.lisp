@@ -0,0 +1,27 @@
+(load "tests/lisp/check.lisp")
+
+(def-data box (box v))
+
+(def (make-values)
+     (let ((s (string "ab" "cd"))
+           (c (let ((n 5)) (fn () n))))
+       (list s 'sym '(1 2) 1.5 (box s) c *stdout* (syntax->datum 3))))
+(def values (make-values))
+(def copies (list (elem 0 values) (elem 4 values) (elem 5 values)))
+(def values nil)
+(collect-cycles)
+
+(check 'string-survives "abcd" (elem 0 copies))
+(check 'constructed-value-survives (box "abcd") (elem 1 copies))
+(check 'closure-survives 5 ((elem 2 copies)))
+(def copies nil)
+
+(def (kinds xs) (map type-of xs))
+(check 'kinds-preserved
+       (list ^string ^symbol ^(list i64) ^f64 ^box)
+       (kinds (list "a" 'a '(1) 1.5 (box 1))))
+
+(def strings (map (fn (x) (string x)) (range 1 1000)))
+(def kept (elem 999 strings))
+(def strings nil)
+(check 'last-string-survives "1000" kept)
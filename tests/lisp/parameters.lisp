@@ -0,0 +1,27 @@
+(load "tests/lisp/check.lisp")
+
+;;; Optional, named and rest parameters are bound from compiled parameter
+;;; descriptors
+
+(def (opt a &opt (b (+ a 1)) (c (+ b 1))) (list a b c))
+(check 'optional-defaults '(1 2 3) (opt 1))
+(check 'optional-default-uses-previous '(1 5 6) (opt 1 5))
+
+(def (key &key (x 1) (y (* x 10))) (list x y))
+(check 'keyword-defaults-in-order '(1 10) (key))
+(check 'keyword-default-uses-previous '(2 20) (key :x 2))
+(check 'keywords-in-any-order '(3 4) (key :y 4 :x 3))
+
+(def (key2 a &key (b 2) c) (list a b c))
+(check 'keyword-defaults '(1 2 ()) (key2 1))
+
+(def (many &key a b c d e f g) (list a b c d e f g))
+(check 'many-keywords '(1 2 3 4 5 6 7) (many :g 7 :c 3 :a 1 :f 6 :b 2 :e 5 :d 4))
+(check 'unknown-keyword 'error/domain-error (head (try (many :h 1))))
+
+(def (rest a &rest bs) (list a bs))
+(check 'empty-rest '(1 ()) (rest 1))
+(check 'rest '(1 (2 3)) (rest 1 2 3))
+
+(def (loop-keys n acc) (if (= n 0) acc (loop-keys (- n 1) (+ acc (head (key :x n))))))
+(check 'keywords-in-loop 5050 (loop-keys 100 0))
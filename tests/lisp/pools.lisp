@@ -0,0 +1,25 @@
+(load "tests/lisp/check.lisp")
+
+(def (cons-class) (elem 3 (pool-stats)))
+(def (live) (elem 1 (cons-class)))
+(def (peak) (elem 2 (cons-class)))
+(def (slabs) (elem 3 (cons-class)))
+
+(check 'cons-size-class 48 (elem 0 (cons-class)))
+
+(def before (live))
+(def xs (range 1 20000))
+(def allocated (live))
+(check 'conses-counted 20000 (- allocated before))
+(def xs nil)
+(def freed (live))
+(check 'conses-returned before freed)
+
+(def first-peak (peak))
+(def first-slabs (slabs))
+(def xs (range 1 20000))
+(def xs nil)
+(def second-peak (peak))
+(def second-slabs (slabs))
+(check 'slots-reused first-peak second-peak)
+(check 'no-new-slabs first-slabs second-slabs)
@@ -0,0 +1,21 @@
+(load "tests/lisp/check.lisp")
+
+;;; Errors are reported at the innermost form being evaluated
+
+(def (error-form result) (syntax->datum (elem 2 result)))
+
+(check 'argument-form '(+ 1 'a) (error-form (try (list 1 (+ 1 'a)))))
+(check 'undefined-name-form 'undefined-name (error-form (try (list 1 (list (undefined-name 2))))))
+(check 'form-in-function '(+ x 'b) (error-form (try ((fn (x) (list x (+ x 'b))) 1))))
+
+;; Forms created by a macro have no position, so the macro call is reported
+(def-macro (add-to-a x) (list '+ x ''a))
+(check 'form-in-macro-expansion '(add-to-a 1) (error-form (try (list (add-to-a 1)))))
+
+(check 'form-after-caught-error '(+ 2 'c) (do (try (+ 1 'a)) (error-form (try (+ 2 'c)))))
+
+;; An uncaught error shows the position of the form
+(def (inner x)
+     (list x
+           (+ x 'd)))
+(list 0 (inner 1))
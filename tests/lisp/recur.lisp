@@ -0,0 +1,25 @@
+(load "tests/lisp/check.lisp")
+
+;;; Continue rebinds the variables of recur and self-calling functions in place
+
+(def (loop-sum n) (let acc 0) (recur (n acc) (if (= n 0) acc (continue (- n 1) (+ acc n)))))
+(check 'recur-loop 5000050000 (loop-sum 100000))
+
+;; Every argument is evaluated before any variable is rebound
+(def (swap-loop n a b) (recur (n a b) (if (= n 0) (list a b) (continue (- n 1) b a))))
+(check 'swapped-arguments '(2 1) (swap-loop 3 1 2))
+(def (fib n) (let a 0) (let b 1) (recur (n a b) (if (= n 0) a (continue (- n 1) b (+ a b)))))
+(check 'arguments-use-old-values 6765 (fib 20))
+
+;; Closures created in an iteration keep the values of that iteration
+(def (closures n)
+     (let fs '())
+     (recur (n fs)
+            (if (= n 0) fs (continue (- n 1) (cons (fn () n) fs)))))
+(check 'closures-keep-iteration-values '(1 2 3) (map (fn (f) (f)) (closures 3)))
+
+(def (match-loop n) (let acc '()) (recur (n acc) (match n (0 acc) (k (continue (- k 1) (cons k acc))))))
+(check 'continue-in-match '(1 2 3 4 5) (match-loop 5))
+
+(def (self-call n acc) (if (= n 0) acc (self-call (- n 1) (+ acc 1))))
+(check 'self-call 1000000 (self-call 1000000 0))
@@ -0,0 +1,20 @@
+(load "tests/lisp/check.lisp")
+
+;;; Special forms are recognized by a field of their symbols
+
+(check 'if '(yes no) (list (if true 'yes 'no) (if false 'yes 'no)))
+(check 'let 3 (let ((a 1) (b 2)) (+ a b)))
+(check 'match 'two (match '(1 2) ((a) 'one) ((a b) 'two)))
+(check 'do 2 (do 1 2))
+(check 'fn 4 ((fn (x) (* x x)) 2))
+(check 'try '(1) (tail (try 1)))
+(check 'loop '(2 4) (loop (for x '(1 2)) (collect (* x 2))))
+(check 'recur 6 (let ((n 3) (acc 0)) (recur (n acc) (if (= n 0) acc (continue (- n 1) (+ acc n))))))
+
+;; Special form names are ordinary symbols when quoted
+(check 'special-form-name "if" (symbol-name 'if))
+(check 'special-form-in-data '(let do fn) (map (fn (x) x) '(let do fn)))
+
+;; Special forms take effect in macro expansions
+(def-macro (unless c x) (list 'if c ''none x))
+(check 'special-form-in-expansion '(none 1) (list (unless true 1) (unless false 1)))
@@ -0,0 +1,26 @@
+(load "tests/lisp/check.lisp")
+
+;;; Calls are recorded on a shadow stack, which becomes the stack trace of an
+;;; error
+
+(def (trace-of result) (elem 3 result))
+(def (trace-forms result) (map (fn (frame) (syntax->datum (elem 2 frame))) (trace-of result)))
+(def (trace-args result) (map (fn (frame) (elem 1 frame)) (trace-of result)))
+
+(def (fail x) (+ x 'a))
+(def (middle x) (+ 1 (fail (* x 2))))
+(def (top x) (+ 1 (middle (+ x 1))))
+
+(check 'trace-forms '((+ x 'a) (fail (* x 2)) (middle (+ x 1)) (top 1)) (trace-forms (try (top 1))))
+(check 'trace-arguments '((4 a) (4) (2) (1)) (trace-args (try (top 1))))
+
+;; Frames of calls that returned normally are not in the trace
+(def (succeed x) (+ 1 (* x 2)))
+(check 'returned-calls-removed '((+ x 'a) (fail 5)) (trace-forms (try (do (succeed 1) (fail 5)))))
+
+;; Every try starts with an empty trace
+(try (top 1))
+(check 'trace-after-caught-error '((+ x 'a) (fail 3)) (trace-forms (try (fail 3))))
+
+(def (deep n) (if (= n 0) (+ 1 (fail n)) (+ 1 (deep (- n 1)))))
+(check 'deep-trace 103 (length (trace-of (try (deep 100)))))
@@ -0,0 +1,31 @@
+(load "tests/lisp/check.lisp")
+
+;;; Calls to lambdas in tail position run in constant stack
+
+(def (even? n) (if (= n 0) true (odd? (- n 1))))
+(def (odd? n) (if (= n 0) false (even? (- n 1))))
+(check 'mutual-recursion true (even? 1000000))
+
+(def (count-down n) (if (= n 0) 'done (do (+ 1 1) (count-down (- n 1)))))
+(check 'self-call-in-do 'done (count-down 1000000))
+
+(def (apply-tail f n) (f n))
+(def (bounce n) (if (= n 0) 'done (apply-tail bounce (- n 1))))
+(check 'call-through-argument 'done (bounce 1000000))
+
+;;; Lambdas that were left by a tail call have no frames in stack traces, so a
+;;; trace shows the call that entered the chain of tail calls
+
+(def (trace-forms result)
+     (map (fn (frame) (syntax->datum (elem 2 frame))) (elem 3 result)))
+(def (first &match (x . xs)) x)
+(def (tail-first x) (first x))
+(def (not-tail-first x) (+ 1 (first x)))
+(def (outer x) (tail-first x))
+
+(check 'trace-of-tail-call '((tail-first '())) (trace-forms (try (tail-first '()))))
+(check 'trace-of-non-tail-call '((first x) (not-tail-first '())) (trace-forms (try (not-tail-first '()))))
+(check 'trace-of-tail-call-chain '((outer '())) (trace-forms (try (outer '()))))
+
+;; An uncaught error in tail position reports the same frames
+(outer '())
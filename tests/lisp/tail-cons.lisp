@@ -0,0 +1,41 @@
+(load "tests/lisp/check.lisp")
+
+(def xs (range 1 50000))
+(check 'map-50k 50000 (length (map (fn (x) (+ x 1)) xs)))
+(check 'filter-50k 49999 (length (filter (fn (x) (if (= x 7) false true)) xs)))
+(check 'take-50k 40000 (length (take 40000 xs)))
+(check 'zip-with-50k 50000 (length (zip-with + xs xs)))
+(check 'map-keeps-order '(2 3 4) (map (fn (x) (+ x 1)) '(1 2 3)))
+
+(def (upto a b) (if (= a b) (list b) (cons a (upto (+ a 1) b))))
+(check 'order '(1 2 3 4 5) (upto 1 5))
+(check 'deep 50000 (length (upto 1 50000)))
+
+(def (drop-zeros xs)
+     (if (nil? xs) nil
+       (if (= (head xs) 0)
+         (drop-zeros (tail xs))
+         (cons (head xs) (drop-zeros (tail xs))))))
+(check 'mixed-tail-calls '(1 2 3) (drop-zeros '(0 1 0 2 3 0)))
+
+(def (dotted n) (if (= n 3) 4 (cons n (dotted (+ n 1)))))
+(check 'improper-end '(1 2 . 4) (dotted 1))
+
+(def (nest cons n) (if (= n 0) nil (cons n (nest cons (- n 1)))))
+(check 'local-cons-is-a-call '(2 (1 ())) (nest list 2))
+
+;; Tail positions inside match, let and macro expansions
+(def big (range 1 300000))
+(def (match-map f xs) (match xs (() nil) ((y . ys) (cons (f y) (match-map f ys)))))
+(check 'match-map 300000 (length (match-map (fn (x) x) big)))
+(check 'match-map-order '(2 3 4) (match-map (fn (x) (+ x 1)) '(1 2 3)))
+
+(def (let-map f xs) (if (nil? xs) nil (let ((y (f (head xs)))) (cons y (let-map f (tail xs))))))
+(check 'let-map 300000 (length (let-map (fn (x) x) big)))
+
+(def (cond-map f xs) (cond ((nil? xs) nil) (true (cons (f (head xs)) (cond-map f (tail xs))))))
+(check 'cond-map 300000 (length (cond-map (fn (x) x) big)))
+
+(def (match-count xs n) (match xs (() n) ((y . ys) (match-count ys (+ n 1)))))
+(check 'self-call-in-match 300000 (match-count big 0))
+(def big nil)
@@ -0,0 +1,34 @@
+(load "tests/lisp/check.lisp")
+
+;;; Variables are resolved to frame slots, closure environments and global
+;;; definitions when they are compiled
+
+(def (shadow x) (let ((y (+ x 1))) (let ((x (* y 10))) x)))
+(check 'shadowed-locals 20 (shadow 1))
+
+(def (param-and-let a) (let ((b (+ a 1))) (list a b (let ((a 5)) (+ a b)))))
+(check 'slots-after-inner-let '(1 2 7) (param-and-let 1))
+
+(def (sequential) (do (let a 1) (let b (+ a 1)) (let a (+ a b)) (list a b)))
+(check 'let-statements '(3 2) (sequential))
+
+(def counter 1)
+(def (read-counter) counter)
+(check 'global 1 (read-counter))
+(def counter 2)
+(check 'redefined-global 2 (read-counter))
+
+(def (call-later) (defined-later 3))
+(def (defined-later x) (* x 2))
+(check 'global-defined-later 6 (call-later))
+
+(def (local-shadows-global counter) counter)
+(check 'local-shadows-global 'local (local-shadows-global 'local))
+
+(def (match-slots xs) (match xs ((a b) (list b a)) ((a b c) (list c b a))))
+(check 'match-slots '(3 2 1) (match-slots '(1 2 3)))
+
+(def (let-pattern p) (let (((a . rest) p)) (list a rest)))
+(check 'let-pattern '(1 (2 3)) (let-pattern '(1 2 3)))
+
+(check 'eval-in-scope 4 (let ((y 2)) (eval '(* 2 2))))